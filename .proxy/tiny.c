@@ -0,0 +1,864 @@
+/* $begin tinymain */
+/*
+ * tiny.c - A simple, prethreaded HTTP/1.0 Web server that uses the
+ *     GET method to serve static and dynamic content.
+ *
+ * Updated 11/2019 droh
+ *   - Fixed sprintf() aliasing issue in serve_static(), and clienterror().
+ */
+
+#include "csapp.h"
+// 요청 파서와 헤더 분류 테이블은 프록시와 같은 것을 쓴다.
+#include "http_parser.h"
+// 연결을 작업 스레드에게 넘기는 유한 버퍼
+#include "sbuf.h"
+// 정적 파일의 열린 식별자와 stat 결과 캐시
+#include "fcache.h"
+// 상주 CGI 워커 풀
+#include "cgipool.h"
+// 프로세스 안에서 도는 동적 컨텐츠 핸들러 모듈
+#include "module.h"
+
+// 11.8serve_dynamic
+#include <signal.h>
+// 정적 파일 본문을 커널 안에서 바로 소켓으로 보낸다.
+#include <sys/sendfile.h>
+// TCP_NODELAY
+#include <netinet/tcp.h>
+
+#include <zlib.h>
+
+// accept4는 _GNU_SOURCE를 켜야 선언되는데, 켜면 csapp.h의 gai_error가 glibc의 것과 부딪히므로 직접 선언한다.
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+
+// 한 요청에서 받아 주는 바이트 범위의 최대 개수 - 넘으면 Range를 무시하고 전체를 보낸다.
+#define MAX_RANGES 16
+// sendfile 한 번에 보내는 최대 바이트 수 - 큰 파일은 이 크기씩 나눠 보낸다.
+#define SENDFILE_CHUNK (1 << 20)
+
+// Range 요청의 한 구간
+typedef struct {
+  off_t start;
+  off_t len;
+} byte_range;
+
+void doit(int fd);
+int serve_request(int fd, rio_t *rp);
+int keep_alive(http_req_t *req);
+void read_requesthdrs(http_req_t *req);
+int parse_uri(char *uri, char *filename, char *cgiargs);
+// 11.11
+int serve_static(int fd, char *filename, fcache_ent *f, char *method, http_req_t *req, int keep);
+int not_modified(http_req_t *req, fcache_ent *f);
+int parse_ranges(http_req_t *req, fcache_ent *f, byte_range *ranges);
+int serve_ranges(int fd, fcache_ent *f, byte_range *ranges, int n, char *conn);
+int send_body(int fd, fcache_ent *f, off_t offset, off_t len);
+void get_filetype(char *filename, char *filetype);
+void build_static_resp(fcache_ent *f);
+int gzip_type(char *filetype);
+char *gzip_file(fcache_ent *f);
+int send_head(int fd, char *buf, size_t n);
+int send_file(int fd, int srcfd, off_t offset, off_t count);
+// 11.11
+void serve_dynamic(int fd, char *filename, char *cgiargs, char *method, struct stat *sbuf);
+int clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
+void *thread(void *vargp);
+
+// 작업 스레드 수 기본값과 accept한 연결을 쌓아 둘 버퍼 칸 수
+#define NTHREADS 16
+#define SBUFSIZE 256
+// 지속 연결에서 다음 요청을 기다리는 시간(초)
+#define KEEPALIVE_TIMEOUT 5
+
+// 메인 스레드가 accept한 연결을 작업 스레드들이 꺼내 간다.
+sbuf_t sbuf;
+
+int main(int argc, char **argv) {
+  int listenfd, connfd, nthreads = NTHREADS, i;
+  char hostname[MAXLINE], port[MAXLINE];
+  socklen_t clientlen;
+  struct sockaddr_storage clientaddr;
+  pthread_t tid;
+
+  /* Check command line args */
+  // 명령줄 인수를 확인하여 서버가 사용할 포트 번호와 작업 스레드 수를 결정
+  // 포트 번호를 받지 않으면 사용법을 출력하고 프로그램을 종료
+  if (argc != 2 && argc != 3) {
+    fprintf(stderr, "usage: %s <port> [nthreads]\n", argv[0]);
+    exit(1);
+  }
+  if (argc == 3 && (nthreads = atoi(argv[2])) <= 0) {
+    fprintf(stderr, "usage: %s <port> [nthreads]\n", argv[0]);
+    exit(1);
+  }
+
+  // 11.8
+  // SIGPIPE - 파이프, 소켓에 쓰려고 할 때 다른 쪽에서 닫힐 경우 전송되는 신호 운영체제가 프로세스에게 데이터를 전송할 수 없을을 알리는 방법
+  // 해당 프로세스가 해당 신호를 수신 시 무시하도록 설정 프로세스가 닫힌 파이프 또는 소켓에 쓰려고 시도 시 종료X
+  // 처리 방식은 프로세스 전체에 걸리므로 스레드를 만들기 전에 한 번만 설정한다.
+  signal(SIGPIPE, SIG_IGN);
+
+  // 서버 소켓을 연다.
+  // 지정된 포트 번호에서 클라이언트의 연결을 수신하기 위한 소켓 생성 후 반환
+  // 듣기 소켓은 open_listenfd가 close-on-exec로 만들어서 CGI 자식이 물려받지 않는다.
+  listenfd = Open_listenfd(argv[1]);
+
+  // 작업 스레드 풀을 미리 만들어 둔다.
+  // 각 스레드는 sbuf에서 연결을 하나씩 꺼내 처리하므로
+  // 느린 클라이언트나 CGI 하나가 다른 연결을 막지 않는다.
+  sbuf_init(&sbuf, SBUFSIZE);
+  fcache_init(build_static_resp);
+  cgipool_init();
+  // 핸들러 모듈은 작업 스레드가 돌기 전에 모두 불러 둔다.
+  module_init(MODULE_DIR);
+  for (i = 0; i < nthreads; i++)
+    Pthread_create(&tid, NULL, thread, NULL);
+
+  // 웹 서버의 핵심 로직
+  // 무한 루프를 실행하여 클라이언트의 연결을 수락하고 처리
+  while (1) {
+    clientlen = sizeof(clientaddr);
+    // 클라이언트의 연결을 수락
+    // 수락된 연결 소켓 connfd를 반환한다.
+    // 다른 스레드가 fork한 CGI 자식이 이 연결을 물려받아 닫히지 않는 일이 없게 한다.
+    // accept 뒤에 따로 플래그를 붙이면 그 사이에 fork할 수 있으므로 accept4로 받으면서 붙인다.
+    // (CGI 자식의 표준 출력은 dup2로 만들므로 이 플래그가 붙지 않는다.)
+    if ((connfd = accept4(listenfd, (SA *)&clientaddr, &clientlen, SOCK_CLOEXEC)) < 0)  // line:netp:tiny:accept
+      unix_error("Accept error");
+    // Getnameinfo를 호출하여 클라이언트의 IP 주소와 포트 번호를 출력
+    // accept 루프는 스레드 하나뿐이라서 역방향 DNS 조회로 막히지 않게 숫자로만 변환한다.
+    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,
+                NI_NUMERICHOST | NI_NUMERICSERV);
+    printf("Accepted connection from (%s, %s)\n", hostname, port);
+
+    // 연결 처리는 작업 스레드에게 넘긴다.
+    // 버퍼가 가득 차면 작업 스레드가 하나 꺼낼 때까지 기다린다.
+    sbuf_insert(&sbuf, connfd);
+  }
+}
+
+// 작업 스레드 - sbuf에서 연결을 하나씩 꺼내 한 개의 HTTP 트랜잭션을 처리한다.
+void *thread(void *vargp)
+{
+  Pthread_detach(pthread_self());
+  while (1) {
+    int connfd = sbuf_remove(&sbuf);
+    // 현재 연결에 대한 처리
+    doit(connfd);   // line:netp:tiny:doit
+    // 연결 처리 후 소켓을 닫는다.
+    Close(connfd);  // line:netp:tiny:close
+  }
+}
+
+// 클라이언트의 연결을 처리하는 역할
+// HTTP/1.1 지속 연결 - 응답을 보낸 뒤에도 연결을 닫지 않고 같은 연결의 다음 요청을 처리한다.
+// 파이프라이닝으로 미리 도착한 다음 요청들은 rio 버퍼에 남아 있다가 차례로 파싱되므로
+// 응답은 요청이 온 순서대로 나간다.
+void doit(int fd)
+{
+  // 입출력 버퍼 초기화 - 연결이 끝날 때까지 요청들이 함께 쓴다.
+  rio_t rio;
+  struct timeval tv = { KEEPALIVE_TIMEOUT, 0 };
+  int on = 1;
+
+  // 놀고 있는 지속 연결이 작업 스레드를 계속 붙잡지 않도록 읽기 시간 제한을 둔다.
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  // 파이프라인의 작은 응답들이 앞 응답의 ACK를 기다리며 묶이지 않게 Nagle을 끈다.
+  // 헤더와 본문을 한 세그먼트로 묶는 것은 writev와 MSG_MORE가 맡는다.
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  // 클라이언트와의 통신을 위한 소켓 파일 디스크립터를 받는다. 
+  Rio_readinitb(&rio, fd); 
+  while (serve_request(fd, &rio))
+    ;
+}
+
+// 한 개의 HTTP 트랜잭션을 처리한다.
+// 응답 뒤에 같은 연결에서 다음 요청을 읽어도 되면 1, 연결을 닫아야 하면 0을 돌려준다.
+int serve_request(int fd, rio_t *rp)
+{
+  int is_static, keep;
+  struct stat sbuf;
+  fcache_ent *f, *gz;
+  char method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+  char filename[MAXLINE], cgiargs[MAXLINE];
+  // 파싱한 요청 라인과 헤더
+  http_req_t req;
+  int rc;
+
+  // 요청 라인과 헤더를 rio 버퍼 안에서 한 번에 파싱한다.
+  // 헤더 이름은 파싱하면서 hdrgen이 만든 해시 테이블로 분류된다.
+  // 클라이언트가 연결을 닫았으면(HTTP_PARSE_EOF) 조용히 끝낸다.
+  // 시간 제한이 지났으면(HTTP_PARSE_AGAIN) 끝내되, 요청을 보내다 멈춘 클라이언트에게는 408을 보낸다.
+  http_req_init(&req);
+  if ((rc = http_read_request(rp, &req)) != HTTP_PARSE_DONE)
+  {
+    if (rc == HTTP_PARSE_TOOBIG)
+      clienterror(fd, "", "431", "Request Header Fields Too Large", "Tiny couldn't buffer the request header");
+    else if (rc == HTTP_PARSE_ERROR)
+      clienterror(fd, "", "400", "Bad request", "Tiny couldn't parse the request");
+    else if (rc == HTTP_PARSE_AGAIN && rp->rio_cnt > 0)
+      clienterror(fd, "", "408", "Request Timeout", "Tiny timed out waiting for the request");
+    return 0;
+  }
+  // 파싱한 헤더를 버퍼에서 소비해서 뒤에 이어 온 요청이 다음 차례에 파싱되게 한다.
+  // 조각이 가리키는 바이트는 다음 읽기 전까지 그대로 남아 있다.
+  http_req_consume(rp, &req);
+  keep = keep_alive(&req);
+  // 요청 라인에서 method, uri, version을 꺼낸다.
+  http_slice_copy(&req.method, method, MAXLINE);
+  http_slice_copy(&req.version, version, MAXLINE);
+  if (http_slice_copy(&req.target, uri, MAXLINE) < 0)
+  {
+    clienterror(fd, "", "414", "URI Too Long", "Tiny couldn't buffer the request URI");
+    return 0;
+  }
+  printf("Request headers: \n");
+  printf("%s %s %s\n", method, uri, version);
+  // Tiny는 HTTP 메소드 중 GET과 HEAD 메소드만 지원
+  // HEAD는 GET과 같은 헤더를 보내고 본문은 보내지 않는다(serve_static, module_serve).
+  // 클라이언트가 다른 메소드를 요청 시, 에러 메시지 전송 후 메인으로 돌아오고, 그 후 연결을 닫고 다음 연결 요청을 기다린다.
+  if (strcasecmp(method, "GET") && strcasecmp(method, "HEAD"))
+  {
+    clienterror(fd, method, "501", "Not implemented", "Tiny does not implement this method");
+    return 0;
+  }
+  // 다른 요청 헤더들을 출력만 하고 무시한다.
+  read_requesthdrs(&req);
+
+  // 모듈이 맡은 URI면 작업 스레드 안에서 바로 처리한다 - fork/exec 하지 않는다.
+  // 응답 길이를 알고 보내므로 연결을 계속 쓸 수 있다.
+  if ((rc = module_serve(fd, uri, method, keep)) != 0)
+    return rc > 0 ? keep : 0;
+
+  // URI를 분석하여 정직, 동적 컨텐츠를 판단한다.
+  // URI를 파일 이름과 비어 있을 수 있는 CGI 인자 스트링으로 분석하고
+  // 요청이 정적 또는 동적 컨텐츠를 위한 것인지 나타내는 플래그를 설정한다.
+  // 만일 이 파일이 디스크 상에 있지 않으면, 에러 메시지를 즉시 클라이언트에게 보내고 리턴한다.
+  is_static = parse_uri(uri, filename, cgiargs);
+
+  if (is_static)
+  {
+    // 정적 컨텐츠를 요청한 경우
+    // 열린 식별자와 stat 결과를 캐시에서 찾는다.
+    // 최근에 확인한 파일이면 경로를 다시 찾지 않는다.
+    if (!(f = fcache_get(filename)))
+    {
+      if (errno == ENOENT || errno == ENOTDIR)
+        clienterror(fd, filename, "404", "Not found", "Tiny couldn't find this file");
+      else
+        clienterror(fd, filename, "403", "Forbidden", "Tiny couldn't read the file");
+      return 0;
+    }
+    // 읽기 권한을 가지고 있는지를 검증한다.
+    if (!(S_IRUSR & f->st.st_mode))
+    {
+      clienterror(fd, filename, "403", "Forbidden", "Tiny couldn't read the file");
+      keep = 0;
+    }
+    else
+    {
+      // 압축할 만한 유형이고 클라이언트가 gzip을 받으면 압축한 표현을 보낸다.
+      // 원본보다 새 .gz 파일이 옆에 있으면 그것을, 없으면 처음 요청 때 압축해서 캐시해 둔 것을 쓴다.
+      if (gzip_type(f->filetype) && http_accepts_gzip(&req) && (gz = fcache_get_gzip(f, 1)))
+      {
+        fcache_put(f);
+        f = gz;
+      }
+      // 정적 컨텐츠를 클라이언트에게 제공한다.
+      if (serve_static(fd, filename, f, method, &req, keep) < 0)
+        keep = 0;
+    }
+    fcache_put(f);
+    return keep;
+  }
+  else
+  {
+    if (stat(filename, &sbuf) < 0)
+    {
+      clienterror(fd, filename, "404", "Not found", "Tiny couldn't find this file");
+      return 0;
+    }
+    // 만일 요청이 동적 컨텐츠에 대한 것이라면 이 파일이 실행 가능한지 검증하고
+    if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode))
+    {
+      clienterror(fd, filename, "403", "Forbidden", "Tiny couldn't run the CGI program");
+      return 0;
+    }
+    // 동적 컨텐츠를 클라이언트에게 제공한다.
+    // CGI 프로그램이 응답의 길이를 정하므로 응답이 끝나면 연결을 닫는다.
+    serve_dynamic(fd, filename, cgiargs, method, &sbuf);
+    return 0;
+  }
+}
+
+// 응답 뒤에 연결을 유지할지 결정한다.
+// HTTP/1.1은 Connection: close가 없으면 유지하고, HTTP/1.0은 keep-alive를 요청했을 때만 유지한다.
+// 요청 본문은 읽지 않으므로 본문이 딸린 요청 뒤에는 다음 요청의 시작을 알 수 없어 닫는다.
+int keep_alive(http_req_t *req)
+{
+  http_slice_t close_tok = { "close", 5 }, keep_tok = { "keep-alive", 10 }, *cl;
+
+  if (http_req_header(req, HDR_TRANSFER_ENCODING))
+    return 0;
+  if ((cl = http_req_header(req, HDR_CONTENT_LENGTH)) && !http_slice_eq(cl, "0"))
+    return 0;
+  if (http_slice_eq(&req->version, "HTTP/1.1"))
+    return !http_conn_listed(req, &close_tok);
+  return http_conn_listed(req, &keep_tok);
+}
+
+// 클라이언트에게 에러 응답을 보내는 역할
+// HTTP 응답을 응답 라인에 적절한 상태 코드와 상태 메시지와 함께 클라이언트에게 전송
+// 브라우저 사용자에게 에러를 설명하는 응답 본체에 HTML 파일도 보낸다.
+// fd, 에러 원인 설명, HTTP 응답코드, 간단한 상태 메시지, 긴 설명 메시지
+// 클라이언트가 끊어서 쓰지 못하면 스레드를 끝내지 않고 -1을 반환한다. 호출한 쪽은 연결을 닫는다.
+int clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg)
+{
+  // HTTP 응답 헤더, HTML 응답 본문 문자열
+  char buf[MAXLINE], body[MAXBUF];
+
+  // 응답 본문 
+  sprintf(body, "<html><title>Tiny Error</title>");
+  sprintf(body, "%s<body bgcolor=""fffff"">\r\n", body);
+  sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
+  sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
+  sprintf(body, "%s<hr><em>The Tiny Web server</em>\r\n", body);
+
+  // 응답 출력
+  sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
+  if (rio_writen(fd, buf, strlen(buf)) < 0)
+    return -1;
+  sprintf(buf, "Content-type: text/html\r\n");
+  if (rio_writen(fd, buf, strlen(buf)) < 0)
+    return -1;
+  sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
+  
+  // HTTP 응답 헤더와 본문은 클라이언트에게 전송한다.
+  if (rio_writen(fd, buf, strlen(buf)) < 0 || rio_writen(fd, body, strlen(body)) < 0)
+    return -1;
+  return 0;
+}
+
+// 클라이언트로부터 수신한 HTTP 요청의 헤더를 출력하고 무시
+// 헤더는 http_read_request가 이미 파싱해 두었다.
+void read_requesthdrs(http_req_t *req)
+{
+  int i;
+
+  for (i = 0; i < req->nheaders; i++)
+    // 헤더의 내용 표시 - 디버깅 및 로깅 목적 사용
+    printf("%.*s: %.*s\n", (int)req->headers[i].name.len, req->headers[i].name.ptr,
+           (int)req->headers[i].value.len, req->headers[i].value.ptr);
+  printf("\n");
+  return;
+}
+
+// HTTP URI를 분석한다.
+// 요청이 정적, 동적인지 결정하고 해당 파일의 이름과 CGI 인자를 추출
+int parse_uri(char *uri, char * filename, char *cgiargs)
+{
+  char *ptr;
+  
+  // URI 문자열을 검사하여 cgi-bin 문자열이 포함 여부를 확인
+  // 미포함 시 정적으로 간주하고 1을 반환한다.
+  if(!strstr(uri, "cgi-bin")){
+    // 정적 컨텐츠 요청 처리
+    strcpy(cgiargs, "");
+    strcpy(filename, ".");
+    strcat(filename, uri);
+    if (uri[strlen(uri)-1] == '/') 
+      strcat(filename, "home.html");
+    return 1;
+  }
+  // cgi-bin 문자열이 포함 시
+  // CGI 인자를 추출하고 해당 부분을 NULL로 종료하여 
+  // URI 문자열을 파일 이름으로 변환한다.
+  // URI에서 ? 문자을 찾아서 그 위치를 기준으로 URI를 두 부분으로 나누고
+  // 앞 부분을 파일 이름으로 설정
+  // 뒷 부분을 CGI 인자로 설정
+  else {
+    ptr = index(uri, '?');
+    if (ptr){
+      strcpy(cgiargs, ptr+1);
+      // ? 문자를 NULL로 대체하여 파일 이름을 종료한다.
+      *ptr = '\0';
+    }
+    else{
+      strcpy(cgiargs, "");
+    }
+    // 나머지 URI 부분을 상대 리눅스 파일 이름으로 변환한다.
+    strcpy(filename, ".");
+    strcat(filename, uri);
+    return 0;
+  }
+}
+
+// 주어진 파일 이름을 기바능로 해당 파일의 MIME 유형을 결정하고
+// filetype 문자열에 해당 MIME 유형을 설정하는 역할을 한다.
+void get_filetype(char * filename, char *filetype)
+{
+  if(strstr(filename, ".html"))
+    strcpy(filetype, "text/html");
+  else if (strstr(filename, ".gif"))
+    strcpy(filetype, "image/gif");
+  else if(strstr(filename, ".png"))
+    strcpy(filetype, "image/png");
+  else if(strstr(filename, ".jpg"))
+    strcpy(filetype, "image/jpeg");
+  else if(strstr(filename,".mp4"))
+    strcpy(filetype, "video/mp4");
+  else
+    strcpy(filetype, "text/plain");
+}
+
+// 정적 파일을 클라이언트에게 제공하는 역할
+// 응답 헤더는 파일 캐시 항목을 만들 때 build_static_resp가 미리 만들어 두었으므로
+// 여기서는 연결 유지 여부에 맞는 Connection 헤더만 붙여 보낸다.
+// 클라이언트가 가진 사본이 그대로면 304, Range 요청이면 206(또는 416)으로 답한다.
+// 파일은 doit이 파일 캐시에서 받아 온 f의 식별자로 읽는다.
+// 성공하면 0, 클라이언트에게 쓰지 못했으면 -1
+int serve_static(int fd, char *filename, fcache_ent *f, char *method, http_req_t *req, int keep)
+{
+  char *conn = keep ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+  char buf[MAXBUF];
+  struct iovec iov[3];
+  byte_range ranges[MAX_RANGES];
+  int n;
+
+  // 조건부 요청 - 클라이언트의 사본이 그대로면 본문 없이 304로 답한다.
+  if (not_modified(req, f))
+  {
+    n = snprintf(buf, sizeof(buf), "HTTP/1.1 304 Not Modified\r\n"
+                 "Server: Tiny Web Server\r\n"
+                 "ETag: %s\r\n"
+                 "Last-Modified: %s\r\n%s", f->etag, f->last_modified, conn);
+    printf("Response headers: \n%s", buf);
+    return rio_writen(fd, buf, n) == n ? 0 : -1;
+  }
+
+  // 범위 요청 - 이어받기나 동영상 탐색은 파일의 일부만 보낸다.
+  if (!strcasecmp(method, "GET") && (n = parse_ranges(req, f, ranges)) != 0)
+  {
+    if (n > 0)
+      return serve_ranges(fd, f, ranges, n, conn);
+    n = snprintf(buf, sizeof(buf), "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                 "Server: Tiny Web Server\r\n"
+                 "Content-Range: bytes */%lld\r\n"
+                 "Content-length: 0\r\n%s", (long long)f->size, conn);
+    printf("Response headers: \n%s", buf);
+    return rio_writen(fd, buf, n) == n ? 0 : -1;
+  }
+
+  printf("Response headers: \n");
+  printf("%.*s%s", (int)f->head_len, f->resp, conn);
+
+  // 미리 만든 헤더, Connection 헤더와 빈 줄, 메모리에 있으면 본문
+  iov[0].iov_base = f->resp;
+  iov[0].iov_len = f->head_len;
+  iov[1].iov_base = conn;
+  iov[1].iov_len = strlen(conn);
+  iov[2].iov_base = f->resp + f->head_len;
+  iov[2].iov_len = f->size;
+
+  // 11.11
+  // HTTP HEAD 메소드 처리 - 헤더만 보낸다.
+  if (strcasecmp(method, "HEAD") == 0)
+    return rio_writev(fd, iov, 2) < 0 ? -1 : 0;
+
+  // 작은 파일 - 본문이 헤더 바로 뒤에 있으므로 writev 한 번이면 끝난다.
+  if (f->resp_len == f->head_len + f->size)
+    return rio_writev(fd, iov, 3) < 0 ? -1 : 0;
+
+  // 헤더는 본문과 같은 세그먼트로 묶이도록 MSG_MORE로 보내고
+  // 본문은 sendfile로 페이지 캐시에서 소켓으로 바로 보낸다.
+  // 파일 전체를 사용자 공간으로 읽어 들이지 않으므로 파일 크기나 동시 연결 수에 따라
+  // 메모리 사용량이 늘지 않는다.
+  // 클라이언트가 먼저 끊어도 서버 전체가 종료되지 않게 에러는 돌려주기만 한다.
+  // 캐시의 식별자는 여러 스레드가 함께 쓰므로 파일 위치를 바꾸지 않고 오프셋을 지정해 읽는다.
+  memcpy(buf, f->resp, f->head_len);
+  memcpy(buf + f->head_len, conn, iov[1].iov_len);
+  if (send_head(fd, buf, f->head_len + iov[1].iov_len) < 0)
+    return -1;
+  return send_file(fd, f->fd, 0, f->size);
+}
+
+// If-None-Match나 If-Modified-Since로 보아 클라이언트의 사본이 그대로인지 확인한다.
+// 둘 다 있으면 If-None-Match만 본다(RFC 7232 6).
+int not_modified(http_req_t *req, fcache_ent *f)
+{
+  http_slice_t *v;
+  time_t since;
+
+  if ((v = http_req_header(req, HDR_IF_NONE_MATCH)))
+    return http_etag_match(v, f->etag);
+  if ((v = http_req_header(req, HDR_IF_MODIFIED_SINCE)) && (since = http_date(v->ptr, v->len)) != 0)
+    return f->st.st_mtime <= since;
+  return 0;
+}
+
+// Range 헤더("bytes=0-99, 200-, -50")를 읽어서 파일 안의 구간들로 바꾼다.
+// 반환값: 구간 수, Range를 무시하고 전체를 보내야 하면 0, 만족할 수 있는 구간이 없으면 -1
+// Range가 없거나, If-Range의 검증자가 다르거나, 형식이 잘못됐거나, 구간이 MAX_RANGES개를 넘으면
+// 전체를 보낸다(RFC 7233 3.1, 3.2).
+int parse_ranges(http_req_t *req, fcache_ent *f, byte_range *ranges)
+{
+  http_slice_t *v, *ir;
+  char buf[MAXLINE], *p, *tok, *dash, *end;
+  off_t size = f->size, first, last;
+  int n = 0;
+
+  if (!(v = http_req_header(req, HDR_RANGE)))
+    return 0;
+  // If-Range - 가진 부분이 지금 파일의 것일 때만 나머지 구간을 보낸다.
+  // 엔터티 태그는 강한 비교를 하므로 약한 태그는 언제나 다르다.
+  if ((ir = http_req_header(req, HDR_IF_RANGE)))
+  {
+    if (ir->len > 0 && ir->ptr[0] == '"')
+    {
+      if (ir->len != strlen(f->etag) || memcmp(ir->ptr, f->etag, ir->len))
+        return 0;
+    }
+    else if (ir->len >= 2 && !strncmp(ir->ptr, "W/", 2))
+      return 0;
+    else if (http_date(ir->ptr, ir->len) != f->st.st_mtime)
+      return 0;
+  }
+  if (http_slice_copy(v, buf, sizeof(buf)) < 0 || strncasecmp(buf, "bytes=", 6))
+    return 0;
+
+  for (p = buf + 6; (tok = strsep(&p, ",")) != NULL; )
+  {
+    tok += strspn(tok, " \t");
+    if (*tok == '\0')
+      continue;
+    if (!(dash = strchr(tok, '-')))
+      return 0;
+    *dash++ = '\0';
+    if (*tok == '\0')
+    {
+      // "-n" - 끝에서 n바이트
+      last = strtoll(dash, &end, 10);
+      if (end == dash || *(end + strspn(end, " \t")) != '\0' || last < 0)
+        return 0;
+      if (last == 0 || size == 0)
+        continue;
+      first = last >= size ? 0 : size - last;
+      last = size - 1;
+    }
+    else
+    {
+      // "a-b" 또는 "a-"
+      first = strtoll(tok, &end, 10);
+      if (end == tok || *end != '\0' || first < 0)
+        return 0;
+      dash += strspn(dash, " \t");
+      if (*dash == '\0')
+        last = size - 1;
+      else
+      {
+        last = strtoll(dash, &end, 10);
+        if (end == dash || *(end + strspn(end, " \t")) != '\0' || last < first)
+          return 0;
+        if (last >= size)
+          last = size - 1;
+      }
+      // 파일 끝을 넘는 구간은 만족할 수 없다.
+      if (first >= size)
+        continue;
+    }
+    if (n == MAX_RANGES)
+      return 0;
+    ranges[n].start = first;
+    ranges[n].len = last - first + 1;
+    n++;
+  }
+  return n > 0 ? n : -1;
+}
+
+// 206 Partial Content - 구간이 하나면 그 구간만, 여러 개면 multipart/byteranges로 보낸다.
+// 본문은 메모리에 있으면 버퍼에서, 아니면 sendfile로 파일의 해당 오프셋부터 보낸다.
+int serve_ranges(int fd, fcache_ent *f, byte_range *ranges, int n, char *conn)
+{
+  char head[MAXBUF], parts[MAX_RANGES * 256], boundary[32], tail[64];
+  size_t part_off[MAX_RANGES + 1];
+  long long size = f->size, total;
+  int len, tail_len, i;
+
+  if (n == 1)
+  {
+    len = snprintf(head, sizeof(head), "HTTP/1.1 206 Partial Content\r\n"
+                   "Server: Tiny Web Server\r\n"
+                   "Accept-Ranges: bytes\r\n"
+                   "ETag: %s\r\n"
+                   "Last-Modified: %s\r\n"
+                   "Content-Range: bytes %lld-%lld/%lld\r\n"
+                   "Content-length: %lld\r\n"
+                   "Content-type: %s\r\n%s",
+                   f->etag, f->last_modified, (long long)ranges[0].start,
+                   (long long)(ranges[0].start + ranges[0].len - 1), size,
+                   (long long)ranges[0].len, f->filetype, conn);
+    printf("Response headers: \n%s", head);
+    if (send_head(fd, head, len) < 0)
+      return -1;
+    return send_body(fd, f, ranges[0].start, ranges[0].len);
+  }
+
+  // 여러 구간 - 구간마다 경계와 부분 헤더를 붙인다.
+  // 전체 길이를 먼저 알려야 하므로 부분 헤더를 모두 만들어 두고 길이를 더한다.
+  snprintf(boundary, sizeof(boundary), "%08lx%08lx", (unsigned long)time(NULL), (unsigned long)random());
+  total = 0;
+  part_off[0] = 0;
+  for (i = 0; i < n; i++)
+  {
+    part_off[i + 1] = part_off[i] +
+      snprintf(parts + part_off[i], sizeof(parts) - part_off[i],
+               "\r\n--%s\r\nContent-type: %s\r\nContent-range: bytes %lld-%lld/%lld\r\n\r\n",
+               boundary, f->filetype, (long long)ranges[i].start,
+               (long long)(ranges[i].start + ranges[i].len - 1), size);
+    total += ranges[i].len;
+  }
+  tail_len = snprintf(tail, sizeof(tail), "\r\n--%s--\r\n", boundary);
+  total += part_off[n] + tail_len;
+
+  len = snprintf(head, sizeof(head), "HTTP/1.1 206 Partial Content\r\n"
+                 "Server: Tiny Web Server\r\n"
+                 "Accept-Ranges: bytes\r\n"
+                 "ETag: %s\r\n"
+                 "Last-Modified: %s\r\n"
+                 "Content-length: %lld\r\n"
+                 "Content-type: multipart/byteranges; boundary=%s\r\n%s",
+                 f->etag, f->last_modified, total, boundary, conn);
+  printf("Response headers: \n%s", head);
+  if (send_head(fd, head, len) < 0)
+    return -1;
+  for (i = 0; i < n; i++)
+    if (send_head(fd, parts + part_off[i], part_off[i + 1] - part_off[i]) < 0 ||
+        send_body(fd, f, ranges[i].start, ranges[i].len) < 0)
+      return -1;
+  return rio_writen(fd, tail, tail_len) == tail_len ? 0 : -1;
+}
+
+// 파일의 offset부터 len 바이트를 보낸다. 본문이 응답 버퍼에 있으면 거기서 쓰고
+// 아니면 sendfile로 보낸다.
+int send_body(int fd, fcache_ent *f, off_t offset, off_t len)
+{
+  if (f->resp_len == f->head_len + f->size)
+    return rio_writen(fd, f->resp + f->head_len + offset, len) == (ssize_t)len ? 0 : -1;
+  return send_file(fd, f->fd, offset, len);
+}
+
+// 파일 캐시가 새 항목을 만들 때 부르는 함수 - 정적 응답을 미리 직렬화한다.
+// 상태 줄과 헤더는 항목마다 한 번만 만들고, FCACHE_RESP_MAX 이하의 파일은
+// 본문까지 읽어서 헤더 바로 뒤에 붙여 둔다.
+// Connection 헤더와 헤더 끝의 빈 줄은 요청마다 달라서 serve_static이 붙인다.
+// 본문을 다 읽지 못하면(그사이 파일이 줄었으면) 헤더만 두고 sendfile로 보낸다.
+// gzip 변형이면 Content-Encoding을 붙이고, 직접 압축할 변형은 여기서 한 번 압축해 둔다.
+void build_static_resp(fcache_ent *f)
+{
+  char head[MAXBUF], *body = NULL;
+  off_t size;
+  struct tm tm;
+  int n;
+
+  // 파일 이름을 기반으로 MIME 유형을 결정
+  // MIME - 클라이언트에게 전달되는 파일의 종류를 나타낸다.
+  // .gz 파일도 앞의 확장자(index.html.gz의 .html)로 원본의 유형을 알 수 있다.
+  get_filetype(f->path, f->filetype);
+  // 검증자 - 파일이 바뀌면(교체되거나 크기, 수정 시각이 달라지면) 달라진다.
+  // 압축한 표현은 원본과 바이트가 다르므로 검증자도 달라야 한다.
+  snprintf(f->etag, sizeof(f->etag), "\"%llx-%llx-%llx%s\"", (unsigned long long)f->st.st_ino,
+           (unsigned long long)f->st.st_size,
+           (unsigned long long)f->st.st_mtim.tv_sec * 1000000000ULL + f->st.st_mtim.tv_nsec,
+           f->gzip == FCACHE_GZIP_DEFLATE ? "-gz" : "");
+  gmtime_r(&f->st.st_mtime, &tm);
+  strftime(f->last_modified, sizeof(f->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  if (f->gzip == FCACHE_GZIP_DEFLATE && !(body = gzip_file(f)))
+  {
+    f->gzip = FCACHE_GZIP_NONE;
+    return;
+  }
+  size = f->size;
+  // 음답 코드로 성공, 웹 서버 소프트웨어 정보, 범위 요청을 받는다는 것과 검증자
+  // 전송될 파일의 크기, 파일의 MIME 유형을 나타낸다.
+  // 압축할 수 있는 유형은 Accept-Encoding에 따라 표현이 달라지므로 Vary를 붙인다.
+  n = snprintf(head, sizeof(head),
+               "HTTP/1.1 200 OK\r\n"
+               "Server: Tiny Web Server\r\n"
+               "Accept-Ranges: bytes\r\n"
+               "ETag: %s\r\n"
+               "Last-Modified: %s\r\n"
+               "Content-length: %lld\r\n"
+               "Content-type: %s\r\n%s%s",
+               f->etag, f->last_modified, (long long)size, f->filetype,
+               f->gzip != FCACHE_IDENTITY ? "Content-Encoding: gzip\r\n" : "",
+               gzip_type(f->filetype) ? "Vary: Accept-Encoding\r\n" : "");
+
+  f->head_len = f->resp_len = n;
+  if (body)
+  {
+    f->resp = Malloc(n + size);
+    memcpy(f->resp, head, n);
+    memcpy(f->resp + n, body, size);
+    f->resp_len = n + size;
+    free(body);
+    return;
+  }
+  // 큰 파일은 헤더만 두고 요청마다 sendfile로 보낸다.
+  // 처음부터 끝까지 차례로 읽히므로 커널이 미리 읽기를 넉넉히 하도록 알려 둔다.
+  if (size > FCACHE_RESP_MAX)
+  {
+    f->resp = Malloc(n);
+    memcpy(f->resp, head, n);
+    posix_fadvise(f->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return;
+  }
+  f->resp = Malloc(n + size);
+  memcpy(f->resp, head, n);
+  if (pread(f->fd, f->resp + n, size, 0) == (ssize_t)size)
+    f->resp_len = n + size;
+}
+
+// 압축해서 보낼 만한 유형인지 - 이미지와 동영상은 이미 압축되어 있다.
+int gzip_type(char *filetype)
+{
+  return !strncmp(filetype, "text/", 5);
+}
+
+// 파일 전체를 gzip 형식으로 압축해서 malloc한 버퍼로 돌려주고 f->size를 압축한 길이로 바꾼다.
+// 항목마다 한 번만 압축하므로 가장 높은 압축 단계를 쓴다.
+// 파일을 다 읽지 못하거나 압축에 실패하면 NULL
+// 압축한 본문은 응답 버퍼에 있으므로 식별자는 더 쓰지 않아 닫는다.
+char *gzip_file(fcache_ent *f)
+{
+  size_t size = f->st.st_size;
+  char *src = Malloc(size ? size : 1), *dst = NULL;
+  z_stream zs;
+
+  memset(&zs, 0, sizeof(zs));
+  // windowBits에 16을 더하면 zlib 대신 gzip 헤더와 트레일러로 감싼다.
+  if (pread(f->fd, src, size, 0) == (ssize_t)size &&
+      deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK)
+  {
+    uLong bound = deflateBound(&zs, size) + 32;
+
+    dst = Malloc(bound);
+    zs.next_in = (Bytef *)src;
+    zs.avail_in = size;
+    zs.next_out = (Bytef *)dst;
+    zs.avail_out = bound;
+    if (deflate(&zs, Z_FINISH) == Z_STREAM_END)
+      f->size = zs.total_out;
+    else
+    {
+      free(dst);
+      dst = NULL;
+    }
+    deflateEnd(&zs);
+  }
+  free(src);
+  close(f->fd);
+  f->fd = -1;
+  return dst;
+}
+
+// 응답 헤더를 보낸다. 뒤에 본문이 바로 이어지므로 MSG_MORE를 붙여
+// 커널이 헤더만 담은 작은 세그먼트를 먼저 내보내지 않고 본문과 합쳐 보내게 한다.
+// 성공하면 0, 쓰기에 실패하면 -1
+int send_head(int fd, char *buf, size_t n)
+{
+  ssize_t nwritten;
+
+  while (n > 0)
+  {
+    if ((nwritten = send(fd, buf, n, MSG_MORE)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += nwritten;
+    n -= nwritten;
+  }
+  return 0;
+}
+
+// 파일 srcfd의 offset부터 count 바이트를 소켓 fd로 보낸다.
+// 크기와 오프셋은 64비트(off_t)로 다루고 SENDFILE_CHUNK씩 나눠 보내므로
+// 2GB가 넘는 파일도 보낼 수 있고 연결마다 쓰는 메모리는 파일 크기와 상관없이 일정하다.
+// sendfile을 쓸 수 없는 파일(일부 파일 시스템)이면 고정 크기 버퍼로 나눠 복사한다.
+// 성공하면 0, 클라이언트가 끊겼거나 파일이 그사이 짧아졌으면 -1
+int send_file(int fd, int srcfd, off_t offset, off_t count)
+{
+  char buf[MAXBUF];
+  ssize_t n;
+
+  while (count > 0)
+  {
+    if ((n = sendfile(fd, srcfd, &offset, count < SENDFILE_CHUNK ? count : SENDFILE_CHUNK)) > 0)
+    {
+      count -= n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    // sendfile을 지원하지 않으면 아래의 복사로 넘어간다.
+    if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+      break;
+    return -1;
+  }
+
+  // sendfile을 못 쓸 때만 - 버퍼 하나 크기씩 읽어서 쓴다.
+  while (count > 0)
+  {
+    if ((n = pread(srcfd, buf, count < (off_t)sizeof(buf) ? count : (off_t)sizeof(buf), offset)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0 || rio_writen(fd, buf, n) != n)
+      return -1;
+    offset += n;
+    count -= n;
+  }
+  return 0;
+}
+
+// 동적 컨텐츠 처리하고 CGI 실행하여 결과를 클라이언트에게 전달하는 역할
+// 상주 워커 규약을 아는 프로그램은 워커 풀에 맡기고,
+// 모르는 프로그램이나 풀이 가득 찬 경우에만 요청마다 fork/execve 한다.
+void serve_dynamic(int fd, char *filename, char *cgiargs, char *method, struct stat *sbuf)
+{
+  char buf[MAXLINE], *emptylist[] = { NULL }, **envp;
+  pid_t pid;
+
+  // 클라이언트가 이미 끊었으면 CGI 프로그램을 실행하지 않는다. 호출한 쪽이 연결을 닫는다.
+  sprintf(buf, "HTTP/1.0 200 OK\r\n");
+  if (rio_writen(fd, buf, strlen(buf)) < 0)
+    return;
+  sprintf(buf, "Server : Tiny Web Server\r\n");
+  if (rio_writen(fd, buf, strlen(buf)) < 0)
+    return;
+
+  // 상주 워커가 응답을 만들면 끝난다.
+  if (cgipool_serve(fd, filename, sbuf, cgiargs, method))
+    return;
+
+  // CGI 프로그램에게 줄 환경 변수 목록(QUERY_STRING, REQUEST_METHOD)을 fork 전에 부모에서 만든다.
+  envp = cgi_env(cgiargs, method, NULL);
+
+  // 자식 프로세스 생성 - CGI 프로그램을 실행할 역할.
+  if((pid = Fork()) == 0){
+    // 자식 프로세스의 표준출력을 클라이언트 소켓 파일 디스크립터(fd)로 리디렉션
+    // CGI 프로그램 출력이 클라이언트 전송
+    Dup2(fd, STDOUT_FILENO);
+    // CGI 프로그램 실행
+    // filename - 실행할 프로그램의 경로, emptylist - 인자리스트, envp - 환경변수 리스트
+    Execve(filename, emptylist, envp);
+  }
+  Free(envp);
+  // 자식 프로세스 대기
+  // 부모 프로세스에서 자식 프로세스의 실행이 완료될 때까지 대기
+  // 다른 스레드의 CGI 자식을 거둬 가지 않도록 이 스레드가 만든 자식만 기다린다.
+  Waitpid(pid, NULL, 0);
+}
@@ -792,6 +792,44 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 }
 /* $end rio_writen */
 
+/*
+ * rio_writev - Robustly write an iovec list (unbuffered). Writes at
+ *    most IOV_MAX entries per writev call and continues after short
+ *    writes, so iov is modified. Returns the number of bytes written.
+ */
+/* $begin rio_writev */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt) 
+{
+    ssize_t nwritten = 0, total = 0;
+
+    while (1) {
+	/* Skip the entries written in full, then trim the partial one */
+	while (iovcnt > 0 && nwritten >= (ssize_t)iov->iov_len) {
+	    nwritten -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt == 0)
+	    break;
+	iov->iov_base = (char *)iov->iov_base + nwritten;
+	iov->iov_len -= nwritten;
+
+	if ((nwritten = writev(fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX)) <= 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		nwritten = 0;    /* and call writev() again */
+	    else
+		return -1;       /* errno set by writev() */
+	}
+	total += nwritten;
+    }
+    return total;
+}
+/* $end rio_writev */
+
 
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
@@ -800,12 +838,13 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
  *    rio_cnt is the number of unread bytes in the internal buffer. On
  *    entry, rio_read() refills the internal buffer via a call to
  *    read() if the internal buffer is empty.
+ *
+ * rio_fill - Refill the internal buffer if it is empty. Returns the
+ *    number of unread bytes, 0 on EOF or -1 on error.
  */
 /* $begin rio_read */
-static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+static ssize_t rio_fill(rio_t *rp)
 {
-    int cnt;
-
     while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
 	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
 			   sizeof(rp->rio_buf));
@@ -818,6 +857,15 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 	else 
 	    rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
     }
+    return rp->rio_cnt;
+}
+
+static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+{
+    int cnt;
+
+    if ((cnt = rio_fill(rp)) <= 0)
+	return cnt;
 
     /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
     cnt = n;          
@@ -866,33 +914,90 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 
 /* 
  * rio_readlineb - Robustly read a text line (buffered)
+ *    Searches the internal buffer with memchr and copies the line in
+ *    as few memcpy calls as possible instead of one rio_read per byte.
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) { 
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n') {
-                n++;
-     		break;
-            }
-	} else if (rc == 0) {
-	    if (n == 1)
-		return 0; /* EOF, no data read */
-	    else
-		break;    /* EOF, some data was read */
-	} else
+    size_t n = 0, cnt;
+    ssize_t rc;
+    char *bufp = usrbuf, *nl = NULL;
+
+    while (n + 1 < maxlen && nl == NULL) {
+	if ((rc = rio_fill(rp)) < 0)
 	    return -1;	  /* Error */
+	else if (rc == 0)
+	    break;        /* EOF */
+
+	/* Copy up to and including the first newline, or as much as fits */
+	cnt = maxlen - 1 - n;
+	if (rp->rio_cnt < cnt)
+	    cnt = rp->rio_cnt;
+	if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+	    cnt = nl - rp->rio_bufptr + 1;
+	memcpy(bufp, rp->rio_bufptr, cnt);
+	rp->rio_bufptr += cnt;
+	rp->rio_cnt -= cnt;
+	bufp += cnt;
+	n += cnt;
     }
-    *bufp = 0;
-    return n-1;
+    if (maxlen > 0)
+	*bufp = 0;
+    return n;
 }
 /* $end rio_readlineb */
 
+/* 
+ * rio_getlineb - Zero-copy variant of rio_readlineb. On return *linep
+ *    points at the next line (including its '\n', not NUL-terminated)
+ *    inside the internal buffer. If the line is only partly buffered,
+ *    the unread bytes are moved to the front of the buffer and the rest
+ *    is read behind them. A line longer than RIO_BUFSIZE is returned in
+ *    RIO_BUFSIZE pieces. The pointer is valid only until the next read
+ *    on rp. Returns the line length, 0 on EOF or -1 on error.
+ */
+/* $begin rio_getlineb */
+ssize_t rio_getlineb(rio_t *rp, char **linep)
+{
+    char *nl;
+    ssize_t nread, scanned = 0, cnt;
+
+    while (1) {
+	if ((nl = memchr(rp->rio_bufptr + scanned, '\n', rp->rio_cnt - scanned)) != NULL) {
+	    cnt = nl - rp->rio_bufptr + 1;
+	    break;
+	}
+	scanned = rp->rio_cnt;
+	if (rp->rio_cnt == RIO_BUFSIZE) {  /* Line doesn't fit, return a piece */
+	    cnt = rp->rio_cnt;
+	    break;
+	}
+	if (rp->rio_bufptr != rp->rio_buf) {  /* Make room behind the partial line */
+	    memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+	    rp->rio_bufptr = rp->rio_buf;
+	}
+	nread = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt, RIO_BUFSIZE - rp->rio_cnt);
+	if (nread < 0) {
+	    if (errno != EINTR) /* Interrupted by sig handler return */
+		return -1;
+	}
+	else if (nread == 0) {  /* EOF */
+	    if (rp->rio_cnt == 0)
+		return 0;
+	    cnt = rp->rio_cnt;  /* EOF, some data was read */
+	    break;
+	}
+	else
+	    rp->rio_cnt += nread;
+    }
+    *linep = rp->rio_bufptr;
+    rp->rio_bufptr += cnt;
+    rp->rio_cnt -= cnt;
+    return cnt;
+}
+/* $end rio_getlineb */
+
 /**********************************
  * Wrappers for robust I/O routines
  **********************************/
@@ -911,6 +1016,12 @@ void Rio_writen(int fd, void *usrbuf, size_t n)
 	unix_error("Rio_writen error");
 }
 
+void Rio_writev(int fd, struct iovec *iov, int iovcnt) 
+{
+    if (rio_writev(fd, iov, iovcnt) < 0)
+	unix_error("Rio_writev error");
+}
+
 void Rio_readinitb(rio_t *rp, int fd)
 {
     rio_readinitb(rp, fd);
@@ -934,6 +1045,15 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
     return rc;
 } 
 
+ssize_t Rio_getlineb(rio_t *rp, char **linep) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_getlineb(rp, linep)) < 0)
+	unix_error("Rio_getlineb error");
+    return rc;
+} 
+
 /******************************** 
  * Client/server helper functions
  ********************************/
@@ -1012,7 +1132,8 @@ int open_listenfd(char *port)
     /* Walk the list for one that we can bind to */
     for (p = listp; p; p = p->ai_next) {
         /* Create a socket descriptor */
-        if ((listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) 
+        /* Create the socket close-on-exec so CGI children don't inherit it */
+        if ((listenfd = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol)) < 0) 
             continue;  /* Socket failed, try the next */
 
         /* Eliminates "Address already in use" error from bind */
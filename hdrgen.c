@@ -0,0 +1,159 @@
+/*
+ * hdrgen.c - 헤더 이름 완전 해시(perfect hash) 테이블 생성기
+ *
+ * 아래 목록의 헤더 이름을 소문자로 해시했을 때 테이블 안에서 서로 겹치지 않는
+ * 시드를 찾아 http_hdrs.h를 만든다. 빌드할 때 make가 실행한다.
+ *
+ *   ./hdrgen > http_hdrs.h
+ *
+ * 생성된 헤더에는 HDR_* id, 홉 단위(hop-by-hop) 헤더 마스크, 해시 함수와
+ * 테이블이 들어 있고, http_parser.c의 http_header_id가 이 테이블로
+ * 헤더 이름을 해시 한 번과 비교 한 번으로 분류한다.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* 해시 함수 - 생성기에서 쓰는 것과 똑같은 코드를 문자열로 만들어 생성된 헤더에 넣는다.
+   | 0x20으로 영문자의 대소문자를 같게 만든다. 다른 tchar가 겹칠 수는 있지만
+   해시 입력일 뿐이고 최종 비교는 strncasecmp로 정확히 한다. */
+#define HDR_HASH_FUNC \
+static unsigned int hdr_hash(const char *name, size_t len, unsigned int seed) \
+{ \
+    unsigned int h = seed; \
+    size_t i; \
+    for (i = 0; i < len; i++) \
+        h = (h ^ ((unsigned char)name[i] | 0x20)) * 16777619u; \
+    return h ^ (h >> 16); \
+}
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+HDR_HASH_FUNC
+
+/* 홉 단위 헤더 - RFC 7230 6.1. 프록시는 이 헤더를 다음 구간으로 넘기지 않는다. */
+#define HOP 1
+
+/* 분류할 헤더 목록 - 순서대로 HDR_* id가 1부터 붙는다. */
+static const struct {
+    const char *name;
+    const char *macro;
+    int flags;
+} hdrs[] = {
+    {"Host", "HDR_HOST", 0},
+    {"Connection", "HDR_CONNECTION", HOP},
+    {"Proxy-Connection", "HDR_PROXY_CONNECTION", HOP},
+    {"Keep-Alive", "HDR_KEEP_ALIVE", HOP},
+    {"TE", "HDR_TE", HOP},
+    {"Trailer", "HDR_TRAILER", HOP},
+    {"Transfer-Encoding", "HDR_TRANSFER_ENCODING", HOP},
+    {"Upgrade", "HDR_UPGRADE", HOP},
+    {"Proxy-Authenticate", "HDR_PROXY_AUTHENTICATE", HOP},
+    {"Proxy-Authorization", "HDR_PROXY_AUTHORIZATION", HOP},
+    {"User-Agent", "HDR_USER_AGENT", 0},
+    {"Content-Length", "HDR_CONTENT_LENGTH", 0},
+    {"Content-Type", "HDR_CONTENT_TYPE", 0},
+    {"Content-Encoding", "HDR_CONTENT_ENCODING", 0},
+    {"Accept-Encoding", "HDR_ACCEPT_ENCODING", 0},
+    {"Cache-Control", "HDR_CACHE_CONTROL", 0},
+    {"Pragma", "HDR_PRAGMA", 0},
+    {"Expires", "HDR_EXPIRES", 0},
+    {"Date", "HDR_DATE", 0},
+    {"ETag", "HDR_ETAG", 0},
+    {"Last-Modified", "HDR_LAST_MODIFIED", 0},
+    {"If-None-Match", "HDR_IF_NONE_MATCH", 0},
+    {"If-Modified-Since", "HDR_IF_MODIFIED_SINCE", 0},
+    {"Range", "HDR_RANGE", 0},
+    {"If-Range", "HDR_IF_RANGE", 0},
+    {"Surrogate-Key", "HDR_SURROGATE_KEY", 0},
+    {"Cache-Tag", "HDR_CACHE_TAG", 0},
+    {"Vary", "HDR_VARY", 0},
+    {"Expect", "HDR_EXPECT", 0},
+};
+#define NHDRS (int)(sizeof(hdrs) / sizeof(hdrs[0]))
+
+/* 테이블 크기가 size일 때 충돌이 없는 시드를 찾는다. 없으면 0 */
+static unsigned int find_seed(unsigned int size)
+{
+    unsigned char used[1024];
+    unsigned int seed, slot;
+    int i;
+
+    for (seed = 1; seed < 1000000; seed++) {
+        memset(used, 0, size);
+        for (i = 0; i < NHDRS; i++) {
+            slot = hdr_hash(hdrs[i].name, strlen(hdrs[i].name), seed) & (size - 1);
+            if (used[slot])
+                break;
+            used[slot] = 1;
+        }
+        if (i == NHDRS)
+            return seed;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    unsigned int size, seed = 0, slot, hop_mask = 0;
+    const char *table[1024] = {NULL};
+    int index[1024];
+    size_t len, max_len = 0;
+    int i, j;
+
+    /* 헤더 id가 홉 단위 마스크의 비트 번호가 되므로 31개까지 */
+    if (NHDRS >= 32) {
+        fprintf(stderr, "hdrgen: too many headers (%d)\n", NHDRS);
+        exit(1);
+    }
+
+    /* 헤더 수의 두 배 이상인 2의 거듭제곱부터 시도해서 가장 작은 테이블을 쓴다. */
+    for (size = 1; size < 2 * NHDRS; size <<= 1)
+        ;
+    for (; size <= 1024 && (seed = find_seed(size)) == 0; size <<= 1)
+        ;
+    if (seed == 0) {
+        fprintf(stderr, "hdrgen: no perfect hash found\n");
+        exit(1);
+    }
+
+    for (i = 0; i < NHDRS; i++) {
+        len = strlen(hdrs[i].name);
+        slot = hdr_hash(hdrs[i].name, len, seed) & (size - 1);
+        table[slot] = hdrs[i].name;
+        index[slot] = i;
+        if (len > max_len)
+            max_len = len;
+        if (hdrs[i].flags & HOP)
+            hop_mask |= 1u << (i + 1);
+    }
+
+    printf("/* http_hdrs.h - generated by hdrgen, do not edit */\n");
+    printf("#ifndef __HTTP_HDRS_H__\n#define __HTTP_HDRS_H__\n\n");
+    printf("#define HDR_OTHER 0\n");
+    for (i = 0; i < NHDRS; i++)
+        printf("#define %s %d\n", hdrs[i].macro, i + 1);
+    printf("#define HDR_COUNT %d\n\n", NHDRS + 1);
+    printf("/* RFC 7230 hop-by-hop headers */\n");
+    printf("#define HDR_HOP_MASK 0x%08xu\n", hop_mask);
+    printf("#define HDR_IS_HOP(id) ((HDR_HOP_MASK >> (id)) & 1)\n\n");
+    printf("#endif /* __HTTP_HDRS_H__ */\n\n");
+
+    /* 테이블은 http_parser.c 한 곳에서만 정의한다. */
+    printf("#if defined(HTTP_HDRS_TABLE) && !defined(__HTTP_HDRS_TABLE__)\n");
+    printf("#define __HTTP_HDRS_TABLE__\n");
+    printf("#define HDR_TABLE_SIZE %u\n", size);
+    printf("#define HDR_HASH_SEED %uu\n", seed);
+    printf("#define HDR_NAME_MAX %zu\n\n", max_len);
+    printf("%s\n\n", XSTR(HDR_HASH_FUNC));
+    printf("static const struct {\n    const char *name;\n    unsigned char len;\n"
+           "    unsigned char id;\n} hdr_table[HDR_TABLE_SIZE] = {\n");
+    for (j = 0; j < (int)size; j++) {
+        if (table[j] == NULL)
+            continue;
+        i = index[j];
+        printf("    [%d] = {\"%s\", %zu, %s},\n", j, hdrs[i].name, strlen(hdrs[i].name), hdrs[i].macro);
+    }
+    printf("};\n#endif /* HTTP_HDRS_TABLE */\n");
+    exit(0);
+}
@@ -0,0 +1,498 @@
+/*
+ * http_parser.c - 증분(resumable) HTTP 요청/응답 헤더 파서
+ *
+ * 요청 라인(또는 응답의 상태 라인)과 헤더를 바이트 단위 상태 기계로 한 번만 훑는다.
+ * 줄마다 rio_readlineb로 복사하고 sscanf/strncasecmp로 다시 훑던 방식과 달리
+ * 결과는 입력 버퍼 안을 가리키는 조각(http_slice_t)이고,
+ * 헤더 이름은 파싱하면서 바로 HDR_* id로 분류한다.
+ */
+/* strptime(), timegm() - _GNU_SOURCE는 csapp.h의 gai_error와 충돌하므로 쓰지 않는다. */
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#define HTTP_HDRS_TABLE   /* hdrgen이 만든 해시 테이블을 여기서만 정의한다. */
+#include "http_parser.h"
+
+/* 파서 상태 */
+#define S_METHOD      0   /* 메서드 토큰 */
+#define S_TARGET      1   /* 요청 대상(URI) */
+#define S_VERSION     2   /* HTTP 버전 */
+#define S_LINE_LF     3   /* 요청 라인 끝의 '\n' */
+#define S_HDR_START   4   /* 헤더 줄의 시작 - 빈 줄이면 헤더 끝 */
+#define S_HDR_NAME    5   /* 헤더 이름 */
+#define S_HDR_OWS     6   /* ':' 뒤의 공백 */
+#define S_HDR_VALUE   7   /* 헤더 값 */
+#define S_HDR_LF      8   /* 헤더 줄 끝의 '\n' */
+#define S_END_LF      9   /* 빈 줄의 '\n' */
+#define S_DONE       10
+#define S_RESP_VERSION 11 /* 응답 상태 라인의 HTTP 버전 */
+#define S_RESP_STATUS  12 /* 세 자리 상태 코드 */
+#define S_RESP_REASON  13 /* 사유 문구 */
+
+/* RFC 7230 tchar - 메서드와 헤더 이름에 쓸 수 있는 문자 */
+static int is_tchar(unsigned char c)
+{
+    if (isalnum(c))
+        return 1;
+    return c != '\0' && strchr("!#$%&'*+-.^_`|~", c) != NULL;
+}
+
+/*
+ * 헤더 이름을 HDR_* id로 분류한다 - 접두사가 아니라 이름 전체가 같아야 한다.
+ * hdrgen이 빌드할 때 만든 완전 해시 테이블이라 해시 한 번으로 칸이 정해지고
+ * 그 칸의 이름과 한 번만 비교한다.
+ */
+int http_header_id(const char *name, size_t len)
+{
+    unsigned int slot;
+
+    if (len == 0 || len > HDR_NAME_MAX)
+        return HDR_OTHER;
+    slot = hdr_hash(name, len, HDR_HASH_SEED) & (HDR_TABLE_SIZE - 1);
+    if (hdr_table[slot].len == len && !strncasecmp(hdr_table[slot].name, name, len))
+        return hdr_table[slot].id;
+    return HDR_OTHER;
+}
+
+void http_req_init(http_req_t *r)
+{
+    int i;
+
+    r->state = S_METHOD;
+    r->pos = r->mark = 0;
+    r->nheaders = 0;
+    r->head_len = 0;
+    for (i = 0; i < HDR_COUNT; i++)
+        r->hdr_index[i] = -1;
+    r->status = 0;
+    r->reason_off = r->reason_len = 0;
+}
+
+/* 원격 서버 응답의 상태 라인부터 파싱하도록 시작한다. */
+void http_resp_init(http_req_t *r)
+{
+    http_req_init(r);
+    r->state = S_RESP_VERSION;
+    r->method_off = r->method_len = 0;
+    r->target_off = r->target_len = 0;
+}
+
+/* 파싱이 끝나면 저장해 둔 오프셋을 buf 기준 포인터로 바꾼다. */
+static void finish(http_req_t *r, char *buf)
+{
+    int i;
+
+    r->method.ptr = buf + r->method_off;
+    r->method.len = r->method_len;
+    r->target.ptr = buf + r->target_off;
+    r->target.len = r->target_len;
+    r->version.ptr = buf + r->version_off;
+    r->version.len = r->version_len;
+    r->reason.ptr = buf + r->reason_off;
+    r->reason.len = r->reason_len;
+    for (i = 0; i < r->nheaders; i++) {
+        r->headers[i].name.ptr = buf + r->hname_off[i];
+        r->headers[i].value.ptr = buf + r->hvalue_off[i];
+    }
+    r->head_len = r->pos;
+    r->state = S_DONE;
+}
+
+/* 완성된 헤더 한 줄을 기록하고 이름을 한 번만 분류한다. */
+static int add_header(http_req_t *r, char *buf)
+{
+    http_header_t *h;
+    int n = r->nheaders;
+
+    if (n == HTTP_MAX_HEADERS)
+        return HTTP_PARSE_TOOBIG;
+    h = &r->headers[n];
+    r->hname_off[n] = r->name_off;
+    h->name.len = r->name_len;
+    r->hvalue_off[n] = r->mark;
+    h->value.len = r->value_end - r->mark;
+    h->id = http_header_id(buf + r->name_off, r->name_len);
+    if (h->id != HDR_OTHER && r->hdr_index[h->id] == -1)
+        r->hdr_index[h->id] = n;
+    r->nheaders++;
+    return HTTP_PARSE_AGAIN;
+}
+
+/*
+ * http_parse_request - buf[0..len)에 있는 요청 헤더를 파싱한다.
+ * buf는 요청의 시작을 가리켜야 하고, 앞선 호출보다 len이 같거나 커야 한다.
+ * 이전 호출에서 멈춘 곳(r->pos)부터 이어서 보므로 각 바이트는 한 번만 검사한다.
+ */
+int http_parse_request(http_req_t *r, char *buf, size_t len)
+{
+    size_t p = r->pos;
+    unsigned char c;
+    char *q;
+    int rc;
+
+    while (p < len) {
+        c = buf[p];
+        switch (r->state) {
+        case S_METHOD:
+            if (c == ' ') {
+                if (p == r->mark)
+                    return HTTP_PARSE_ERROR;
+                r->method_off = r->mark;
+                r->method_len = p - r->mark;
+                r->mark = p + 1;
+                r->state = S_TARGET;
+            }
+            else if (!is_tchar(c))
+                return HTTP_PARSE_ERROR;
+            p++;
+            break;
+
+        case S_TARGET:
+            /* URI는 길 수 있으므로 구분자를 memchr로 한 번에 찾는다. */
+            q = memchr(buf + p, ' ', len - p);
+            if (memchr(buf + p, '\n', (q ? q - buf : len) - p))
+                return HTTP_PARSE_ERROR;
+            if (q == NULL) {
+                p = len;
+                break;
+            }
+            p = q - buf;
+            if (p == r->mark)
+                return HTTP_PARSE_ERROR;
+            r->target_off = r->mark;
+            r->target_len = p - r->mark;
+            r->mark = ++p;
+            r->state = S_VERSION;
+            break;
+
+        case S_VERSION:
+            if (c == '\r' || c == '\n') {
+                r->version_off = r->mark;
+                r->version_len = p - r->mark;
+                if (r->version_len != 8 || strncmp(buf + r->mark, "HTTP/1.", 7))
+                    return HTTP_PARSE_ERROR;
+                r->state = (c == '\r') ? S_LINE_LF : S_HDR_START;
+            }
+            p++;
+            break;
+
+        case S_RESP_VERSION:
+            if (c == ' ') {
+                r->version_off = r->mark;
+                r->version_len = p - r->mark;
+                if (r->version_len != 8 || strncmp(buf + r->mark, "HTTP/1.", 7))
+                    return HTTP_PARSE_ERROR;
+                r->mark = p + 1;
+                r->state = S_RESP_STATUS;
+            }
+            else if (c == '\r' || c == '\n')
+                return HTTP_PARSE_ERROR;
+            p++;
+            break;
+
+        case S_RESP_STATUS:
+            if (isdigit(c) && p - r->mark < 3)
+                r->status = r->status * 10 + (c - '0');
+            else if (p - r->mark != 3)
+                return HTTP_PARSE_ERROR;
+            else if (c == ' ') {
+                r->mark = p + 1;
+                r->state = S_RESP_REASON;
+            }
+            else if (c == '\r' || c == '\n') {
+                /* 사유 문구는 비어 있을 수 있다. */
+                r->reason_off = p;
+                r->state = (c == '\r') ? S_LINE_LF : S_HDR_START;
+            }
+            else
+                return HTTP_PARSE_ERROR;
+            p++;
+            break;
+
+        case S_RESP_REASON:
+            if (c == '\r' || c == '\n') {
+                r->reason_off = r->mark;
+                r->reason_len = p - r->mark;
+                r->state = (c == '\r') ? S_LINE_LF : S_HDR_START;
+            }
+            p++;
+            break;
+
+        case S_LINE_LF:
+        case S_HDR_LF:
+            if (c != '\n')
+                return HTTP_PARSE_ERROR;
+            if (r->state == S_HDR_LF && (rc = add_header(r, buf)) != HTTP_PARSE_AGAIN)
+                return rc;
+            r->state = S_HDR_START;
+            p++;
+            break;
+
+        case S_HDR_START:
+            p++;
+            if (c == '\r')
+                r->state = S_END_LF;
+            else if (c == '\n') {
+                r->pos = p;
+                finish(r, buf);
+                return HTTP_PARSE_DONE;
+            }
+            else if (is_tchar(c)) {
+                r->name_off = p - 1;
+                r->state = S_HDR_NAME;
+            }
+            else
+                /* obs-fold(공백으로 시작하는 이어진 줄)는 받지 않는다. */
+                return HTTP_PARSE_ERROR;
+            break;
+
+        case S_HDR_NAME:
+            if (c == ':') {
+                r->name_len = p - r->name_off;
+                r->state = S_HDR_OWS;
+            }
+            else if (!is_tchar(c))
+                return HTTP_PARSE_ERROR;
+            p++;
+            break;
+
+        case S_HDR_OWS:
+            if (c == ' ' || c == '\t') {
+                p++;
+                break;
+            }
+            r->mark = r->value_end = p;
+            r->state = S_HDR_VALUE;
+            /* fall through */
+
+        case S_HDR_VALUE:
+            /* 값은 줄 끝까지 memchr로 건너뛰고 뒤쪽 공백만 잘라낸다. */
+            if ((q = memchr(buf + p, '\n', len - p)) == NULL) {
+                p = len;
+                break;
+            }
+            r->value_end = q - buf;
+            while (r->value_end > r->mark &&
+                   (buf[r->value_end - 1] == '\r' || buf[r->value_end - 1] == ' ' ||
+                    buf[r->value_end - 1] == '\t'))
+                r->value_end--;
+            p = q - buf;
+            r->state = S_HDR_LF;
+            break;
+
+        case S_END_LF:
+            if (c != '\n')
+                return HTTP_PARSE_ERROR;
+            r->pos = p + 1;
+            finish(r, buf);
+            return HTTP_PARSE_DONE;
+
+        default:
+            return HTTP_PARSE_DONE;
+        }
+    }
+    r->pos = p;
+    return HTTP_PARSE_AGAIN;
+}
+
+/*
+ * http_read_request - rio 버퍼에 요청 헤더 전체가 모일 때까지 읽으면서 파싱한다.
+ * 헤더는 rio_buf 안에서 파싱되므로 결과 조각은 http_req_consume이나
+ * 다음 rio 읽기 전까지만 유효하다.
+ * 반환값: HTTP_PARSE_DONE, 한 바이트도 받기 전에 EOF면 HTTP_PARSE_EOF,
+ *         잘못된 요청이거나 요청 도중에 끊겼으면 HTTP_PARSE_ERROR,
+ *         헤더가 RIO_BUFSIZE를 넘으면 HTTP_PARSE_TOOBIG.
+ *         논블로킹 소켓에서 EAGAIN이거나 SO_RCVTIMEO가 지났으면 HTTP_PARSE_AGAIN을 돌려주고,
+ *         다시 부르면 이어서 파싱한다.
+ */
+int http_read_request(rio_t *rp, http_req_t *r)
+{
+    int rc;
+    ssize_t n;
+
+    while (1) {
+        if ((rc = http_parse_request(r, rp->rio_bufptr, rp->rio_cnt)) != HTTP_PARSE_AGAIN)
+            return rc;
+
+        /* 남은 바이트를 버퍼 앞으로 당겨서 뒤쪽에 이어 읽을 자리를 만든다.
+           파서는 오프셋만 기억하므로 옮겨도 상관없다. */
+        if (rp->rio_bufptr != rp->rio_buf) {
+            memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+            rp->rio_bufptr = rp->rio_buf;
+        }
+        if (rp->rio_cnt == RIO_BUFSIZE)
+            return HTTP_PARSE_TOOBIG;
+
+        n = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt, RIO_BUFSIZE - rp->rio_cnt);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return HTTP_PARSE_AGAIN;
+            return HTTP_PARSE_ERROR;
+        }
+        if (n == 0)     /* 요청 도중에 끊겼으면 잘못된 요청, 시작도 안 했으면 EOF */
+            return rp->rio_cnt == 0 ? HTTP_PARSE_EOF : HTTP_PARSE_ERROR;
+        rp->rio_cnt += n;
+    }
+}
+
+/* 응답 헤더 - 상태 기계가 상태 라인부터 시작한다는 것만 다르다. */
+int http_parse_response(http_req_t *r, char *buf, size_t len)
+{
+    return http_parse_request(r, buf, len);
+}
+
+/* 반환값은 http_read_request와 같다 - 원격 서버가 응답 없이 끊었으면 HTTP_PARSE_EOF */
+int http_read_response(rio_t *rp, http_req_t *r)
+{
+    return http_read_request(rp, r);
+}
+
+/* 파싱한 요청 헤더를 rio 버퍼에서 소비한다 - 이후 본문은 rio_readnb로 이어서 읽는다. */
+void http_req_consume(rio_t *rp, http_req_t *r)
+{
+    rp->rio_bufptr += r->head_len;
+    rp->rio_cnt -= r->head_len;
+}
+
+/* id에 해당하는 첫 헤더의 값, 없으면 NULL */
+http_slice_t *http_req_header(http_req_t *r, int id)
+{
+    if (id <= HDR_OTHER || id >= HDR_COUNT || r->hdr_index[id] == -1)
+        return NULL;
+    return &r->headers[r->hdr_index[id]].value;
+}
+
+/* 조각이 str과 대소문자 구분 없이 같은지 */
+int http_slice_eq(http_slice_t *s, const char *str)
+{
+    return strlen(str) == s->len && !strncasecmp(s->ptr, str, s->len);
+}
+
+/* 조각을 NUL로 끝나는 문자열로 복사한다. 자리가 모자라면 -1 */
+int http_slice_copy(http_slice_t *s, char *dst, size_t size)
+{
+    if (s->len >= size)
+        return -1;
+    memcpy(dst, s->ptr, s->len);
+    dst[s->len] = '\0';
+    return 0;
+}
+
+/*
+ * Connection 헤더 값에 name이 토큰으로 들어 있는지 - RFC 7230 6.1
+ * "Connection: close, X-Foo"처럼 적힌 헤더도 홉 단위라서 전달하면 안 된다.
+ */
+int http_conn_listed(http_req_t *r, http_slice_t *name)
+{
+    http_slice_t *v, tok;
+    char *p, *end;
+    int i;
+
+    for (i = r->hdr_index[HDR_CONNECTION]; i >= 0 && i < r->nheaders; i++) {
+        if (r->headers[i].id != HDR_CONNECTION)
+            continue;
+        v = &r->headers[i].value;
+        end = v->ptr + v->len;
+        /* 쉼표로 나뉜 토큰에서 앞뒤 공백을 빼고 비교한다. */
+        for (p = v->ptr; p < end; p++) {
+            while (p < end && (*p == ' ' || *p == '\t'))
+                p++;
+            tok.ptr = p;
+            while (p < end && *p != ',')
+                p++;
+            tok.len = p - tok.ptr;
+            while (tok.len > 0 && (tok.ptr[tok.len - 1] == ' ' || tok.ptr[tok.len - 1] == '\t'))
+                tok.len--;
+            if (tok.len == name->len && !strncasecmp(tok.ptr, name->ptr, tok.len))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * If-None-Match 값(쉼표로 구분한 엔터티 태그 목록 또는 "*")에 etag가 있는지 확인한다.
+ * If-None-Match는 약한 비교를 하므로 양쪽의 W/ 접두사는 무시한다(RFC 7232 2.3.2).
+ */
+int http_etag_match(http_slice_t *inm, char *etag)
+{
+    char *p = inm->ptr, *end = inm->ptr + inm->len, *tag;
+    size_t len;
+
+    if (etag[0] == '\0')
+        return 0;
+    if (!strncmp(etag, "W/", 2))
+        etag += 2;
+    len = strlen(etag);
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        if (p == end)
+            break;
+        if (*p == '*')
+            return 1;
+        if (end - p > 2 && !strncmp(p, "W/", 2))
+            p += 2;
+        /* 엔터티 태그는 따옴표로 감싸져 있고 안에 쉼표가 올 수 있으므로 닫는 따옴표까지 읽는다. */
+        tag = p;
+        if (*p == '"') {
+            for (p++; p < end && *p != '"'; p++)
+                ;
+            if (p < end)
+                p++;
+        }
+        else
+            while (p < end && *p != ',' && *p != ' ' && *p != '\t')
+                p++;
+        if ((size_t)(p - tag) == len && !memcmp(tag, etag, len))
+            return 1;
+    }
+    return 0;
+}
+
+/* HTTP 날짜(IMF-fixdate)를 읽는다. 형식이 잘못됐으면 0을 반환한다. */
+time_t http_date(const char *s, size_t len)
+{
+    char buf[64];
+    struct tm tm;
+
+    if (len >= sizeof(buf))
+        return 0;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    memset(&tm, 0, sizeof(tm));
+    if (strptime(buf, "%a, %d %b %Y %H:%M:%S GMT", &tm) == NULL)
+        return 0;
+    return timegm(&tm);
+}
+
+/* 클라이언트의 Accept-Encoding에 q=0이 아닌 gzip(또는 x-gzip, *)이 있는지 확인한다. */
+int http_accepts_gzip(http_req_t *req)
+{
+    http_slice_t *ae;
+    char *p, *end, *tok, *seg_end, *q;
+    size_t len;
+
+    if ((ae = http_req_header(req, HDR_ACCEPT_ENCODING)) == NULL)
+        return 0;
+    for (p = ae->ptr, end = ae->ptr + ae->len; p < end; p = seg_end + 1) {
+        /* 쉼표로 구분한 항목 하나 - "coding;q=value" */
+        for (seg_end = p; seg_end < end && *seg_end != ','; seg_end++)
+            ;
+        while (p < seg_end && (*p == ' ' || *p == '\t'))
+            p++;
+        for (tok = p; p < seg_end && *p != ';' && *p != ' ' && *p != '\t'; p++)
+            ;
+        len = p - tok;
+        if (!((len == 4 && !strncasecmp(tok, "gzip", 4)) || (len == 6 && !strncasecmp(tok, "x-gzip", 6))
+            || (len == 1 && *tok == '*')))
+            continue;
+        /* q=0이면 받지 않겠다는 뜻이다. */
+        for (q = p; q + 2 < seg_end; q++)
+            if ((q[0] == 'q' || q[0] == 'Q') && q[1] == '=')
+                return strtod(q + 2, NULL) > 0;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * http_parser.h - 증분(resumable) HTTP 요청/응답 헤더 파서
+ *
+ * 소켓 버퍼(rio_t의 rio_buf)를 그대로 읽으면서 요청 라인과 헤더를
+ * 복사 없이 (포인터, 길이) 조각으로 돌려준다.
+ * 입력이 일부만 도착해도 상태를 저장해 두었다가 다음 호출에서 이어서 파싱하므로
+ * 논블로킹 이벤트 루프에서도 쓸 수 있다.
+ */
+#ifndef __HTTP_PARSER_H__
+#define __HTTP_PARSER_H__
+
+#include "csapp.h"
+
+/* 파서 반환값 */
+#define HTTP_PARSE_DONE    1   /* 요청 헤더 끝(빈 줄)까지 파싱했다 */
+#define HTTP_PARSE_AGAIN   0   /* 입력이 더 필요하다 */
+#define HTTP_PARSE_ERROR  -1   /* 형식이 잘못된 요청 */
+#define HTTP_PARSE_TOOBIG -2   /* 요청 헤더가 버퍼나 헤더 개수 한도를 넘는다 */
+#define HTTP_PARSE_EOF    -3   /* 첫 바이트가 오기 전에 상대가 연결을 닫았다 */
+
+/* 한 요청에서 기억하는 헤더의 최대 개수 */
+#define HTTP_MAX_HEADERS 100
+
+/* 헤더 이름 분류 - HDR_* id와 홉 단위 헤더 마스크는 hdrgen이 만든다.
+   파싱하는 동안 한 번만 분류해서 id로 저장한다. */
+#include "http_hdrs.h"
+
+/* 버퍼 안의 한 구간 - 복사하지 않고 가리키기만 한다. */
+typedef struct {
+    char *ptr;
+    size_t len;
+} http_slice_t;
+
+typedef struct {
+    http_slice_t name;
+    http_slice_t value;
+    int id;                    /* HDR_* */
+} http_header_t;
+
+typedef struct {
+    /* 파서 상태 - 위치는 모두 요청 시작으로부터의 오프셋이라서
+       호출 사이에 버퍼가 옮겨져도(rio_buf 앞으로 당기기) 이어서 파싱할 수 있다. */
+    int state;
+    size_t pos;                /* 다음에 볼 바이트 */
+    size_t mark;               /* 파싱 중인 토큰의 시작 */
+    size_t name_off, name_len; /* 파싱 중인 헤더 이름 */
+    size_t value_end;          /* 파싱 중인 헤더 값의 끝(뒤쪽 공백 제외) */
+    size_t method_off, method_len;
+    size_t target_off, target_len;
+    size_t version_off, version_len;
+    size_t reason_off, reason_len;
+    size_t hname_off[HTTP_MAX_HEADERS];  /* 헤더별 이름/값 오프셋 - 길이는 headers[]에 */
+    size_t hvalue_off[HTTP_MAX_HEADERS];
+
+    /* 결과 - HTTP_PARSE_DONE일 때 채워진다. */
+    http_slice_t method;
+    http_slice_t target;
+    http_slice_t version;
+    int status;                /* 응답일 때 상태 코드 */
+    http_slice_t reason;       /* 응답일 때 사유 문구 */
+    int nheaders;
+    http_header_t headers[HTTP_MAX_HEADERS];
+    int hdr_index[HDR_COUNT];  /* id별 첫 헤더의 위치, 없으면 -1 */
+    size_t head_len;           /* 요청 라인부터 빈 줄까지의 바이트 수 */
+} http_req_t;               /* http_resp_init으로 시작하면 응답 헤더도 담는다. */
+
+void http_req_init(http_req_t *r);
+void http_resp_init(http_req_t *r);
+int http_parse_request(http_req_t *r, char *buf, size_t len);
+int http_parse_response(http_req_t *r, char *buf, size_t len);
+int http_read_request(rio_t *rp, http_req_t *r);
+int http_read_response(rio_t *rp, http_req_t *r);
+void http_req_consume(rio_t *rp, http_req_t *r);
+int http_header_id(const char *name, size_t len);
+int http_conn_listed(http_req_t *r, http_slice_t *name);
+http_slice_t *http_req_header(http_req_t *r, int id);
+int http_slice_eq(http_slice_t *s, const char *str);
+int http_slice_copy(http_slice_t *s, char *dst, size_t size);
+int http_etag_match(http_slice_t *inm, char *etag);
+time_t http_date(const char *s, size_t len);
+int http_accepts_gzip(http_req_t *req);
+
+#endif /* __HTTP_PARSER_H__ */
@@ -1,8 +1,18 @@
 // proxy - cache 구현
 
+// strptime(), timegm() 사용을 위해 필요하다.
+// _GNU_SOURCE는 csapp.h의 gai_error와 충돌하므로 사용하지 않는다.
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/syscall.h>
 
+#include <zlib.h>
 #include "csapp.h"
+#include "http_parser.h"
 
 /* Recommended max cache and object sizes */
 #define MAX_CACHE_SIZE 1049000
@@ -12,47 +22,276 @@
 // LRU(Least Recently Used) 알고리즘 - 가장 오랫동안 참조되지 않은 페이지를 교체하는 기법
 #define LRU_MAGIC_NUMBER 9999
 
+// 캐시 본문 풀의 크기
+// 본문은 내용의 해시로 찾아서 내용이 같은 본문을 여러 캐시 블록이 함께 쓴다.
+#define CACHE_BODY_COUNT (MAX_CACHE_SIZE / MAX_OBJECT_SIZE)
 // 캐시 블록의 총 개수
-#define CACHE_OBJS_COUNT 10
+// 블록에는 URL과 헤더만 있으므로 본문을 함께 쓰는 키가 들어갈 수 있게 본문보다 많이 둔다.
+#define CACHE_OBJS_COUNT (CACHE_BODY_COUNT * 4)
+// 캐시 블록에 저장할 수 있는 상태 라인과 헤더의 최대 길이
+// 파서가 rio 버퍼 안에서 헤더를 읽으므로 그보다 조금 크면 된다(Connection, gzip 헤더).
+#define CACHE_HEAD_SIZE (RIO_BUFSIZE + 256)
+
+// 백그라운드 회수 - 캐시 사용량을 하위 워터마크와 상위 워터마크 사이로 유지한다.
+// 사용량이 상위 워터마크를 넘으면 회수 스레드가 하위 워터마크까지 LRU 블록을 비운다.
+#define CACHE_HIGH_WATERMARK (MAX_CACHE_SIZE * 9 / 10)
+#define CACHE_LOW_WATERMARK (MAX_CACHE_SIZE * 7 / 10)
+// 사용 중인 블록 수의 워터마크 - 새 객체가 바로 들어갈 빈 블록을 남겨 둔다.
+#define CACHE_HIGH_SLOTS (CACHE_OBJS_COUNT - 1)
+#define CACHE_LOW_SLOTS (CACHE_OBJS_COUNT - 2)
+// 사용 중인 본문 수의 워터마크 - 새 본문이 바로 들어갈 빈 칸을 남겨 둔다.
+#define CACHE_HIGH_BODIES (CACHE_BODY_COUNT - 1)
+#define CACHE_LOW_BODIES (CACHE_BODY_COUNT - 2)
+// 회수 스레드가 깨우는 신호 없이도 만료된 블록을 정리하러 깨어나는 주기(초)
+#define RECLAIM_INTERVAL 1
+
+// 네거티브 캐시 - 원격 서버의 오류 응답(404, 5xx)을 짧게 기억한다.
+// 원격 서버가 캐시 헤더를 주지 않았을 때 사용할 기본 TTL(초)
+#define NEG_CACHE_TTL 10
+// 원격 서버가 캐시 헤더를 주더라도 네거티브 항목은 이 시간(초)을 넘기지 않는다.
+#define NEG_CACHE_TTL_MAX 60
+// stale-if-error를 주지 않은 응답이라도 원격 서버 장애 시 만료 후 이 시간(초)까지는 제공한다.
+#define STALE_IF_ERROR_DEFAULT 30
+// stale-while-revalidate, stale-if-error 값의 상한(초) - 만료된 객체를 무한정 제공하지 않는다.
+#define STALE_MAX 3600
+
+// 만료된 캐시 블록을 백그라운드에서 갱신하는 스레드의 수
+#define REFRESH_THREADS 2
+// 동시에 진행 또는 대기할 수 있는 갱신 작업의 최대 개수
+#define REFRESH_QUEUE_SIZE 16
+
+// cache_find가 알려주는 캐시 블록의 상태
+// 신선한 블록
+#define CACHE_FRESH 0
+// 만료되었지만 stale-while-revalidate 기간 안 - 바로 제공하고 백그라운드에서 갱신한다.
+#define CACHE_STALE 1
+// 만료되었지만 stale-if-error 기간 안 - 원격 서버가 실패했을 때만 제공한다.
+#define CACHE_STALE_ERROR 2
+
+// prefork 모드에서 띄울 수 있는 작업 프로세스의 최대 수
+#define PREFORK_MAX 16
+// 캐시 블록마다 읽는 중인 프로세스를 기록하는 칸의 수 - 작업 프로세스와 부모 프로세스
+#define READER_PIDS (PREFORK_MAX + 1)
+
+// 원격 서버 응답의 Surrogate-Key, Cache-Tag 헤더에서 저장할 태그 문자열의 최대 길이
+#define CACHE_TAGS_LEN 512
+// 캐시 블록에 저장할 ETag의 최대 길이 - 더 길면 If-None-Match를 캐시에서 답하지 않는다.
+#define CACHE_ETAG_LEN 128
+// 캐시 블록에 미리 만들어 두는 304 응답 헤더의 최대 길이
+#define CACHE_NM_LEN 1024
+// gzip으로 압축한 변형을 저장하는 캐시 키 - URL 뒤에 붙인다.
+// 요청 대상에는 공백이 올 수 없으므로 어떤 URL과도 겹치지 않고,
+// URL 색인에서 원래 URL 바로 뒤에 놓인다.
+#define CACHE_GZIP_SUFFIX " gzip"
+// gzip 압축 수준 - 응답을 흘려 보내면서 압축하므로 속도와 압축률의 중간값을 쓴다.
+#define GZIP_LEVEL 6
+
+// cache_send가 클라이언트에게 보내는 것
+// 상태 라인과 헤더, 본문 전체
+#define CACHE_SEND_FULL 0
+// 상태 라인과 헤더만(HEAD)
+#define CACHE_SEND_HEAD 1
+// 미리 만들어 둔 304 Not Modified
+#define CACHE_SEND_NOT_MODIFIED 2
+
+// DNS 조회 또는 연결에 실패한 호스트를 기억하는 시간(초)
+#define NEG_HOST_TTL 5
+// 실패한 호스트를 기억하는 테이블의 크기
+#define NEG_HOST_COUNT 16
+
+// CONNECT 터널이 양쪽 모두 조용할 때 닫기까지의 시간(초)
+#define TUNNEL_IDLE_TIMEOUT 60
+// CONNECT로 연결할 수 있는 원격 서버 포트 - 쉼표로 구분해서 더 넣을 수 있다(예: 443, 8443).
+// 다른 포트는 403으로 거절해서 터널이 아무 서비스로나 가는 중계가 되지 않게 한다.
+#define CONNECT_PORTS 443
+// 관리 연결에서 요청을 기다리는 시간(초) - 놀고 있는 연결이 스레드를 계속 붙잡지 않게 한다.
+#define ADMIN_TIMEOUT 5
+// 터널에서 한 번에 옮기는 최대 바이트 수 - 파이프 용량(기본 64KB)에 맞춘다.
+#define TUNNEL_CHUNK 65536
+// splice를 쓸 수 없을 때 read/write로 옮기는 버퍼의 크기
+#define TUNNEL_BUFSIZE 16384
+// splice 플래그 - SPLICE_F_MOVE, SPLICE_F_NONBLOCK
+// fcntl.h의 선언은 _GNU_SOURCE에서만 보이므로 값을 직접 쓴다.
+#define TUNNEL_SPLICE_MOVE 1
+#define TUNNEL_SPLICE_NONBLOCK 2
 
 /* You won't lose style points for including this long line in your code */
 static const char *user_agent_hdr =
     "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 "
     "Firefox/10.0.3\r\n";
 
-static const char *requestline_hdr_format = "GET %s HTTP/1.0\r\n";
+// 요청 라인과 헤더를 이루는 상수 조각 - iovec이 그대로 가리킨다.
+static const char *requestline_sep = " ";
+static const char *requestline_version = " HTTP/1.0\r\n";
+// chunked 요청 본문은 HTTP/1.0으로 보낼 수 없으므로 이 경우에만 HTTP/1.1로 보낸다.
+static const char *requestline_version11 = " HTTP/1.1\r\n";
+static const char *chunked_hdr = "Transfer-Encoding: chunked\r\n";
+static const char *continue_resp = "HTTP/1.1 100 Continue\r\n\r\n";
+static const char *gzip_ce_hdr = "Content-Encoding: gzip\r\n";
+static const char *gzip_vary_hdr = "Vary: Accept-Encoding\r\n";
+static const char *weak_etag = "W/";
+static const char *host_hdr_key = "Host: ";
+static const char *hdr_sep = ": ";
 static const char *endof_hdr = "\r\n";
-static const char *host_hdr_format = "Host: %s\r\n";
 static const char *conn_hdr = "Connection: close\r\n";
 static const char *prox_hdr = "Proxy-Connection: close\r\n";
-static const char *host_key = "Host";
-static const char *connection_key = "Connection";
-static const char *proxy_connection_key = "Proxy-Connection";
-static const char *user_agent_key = "User-Agent";
+
+// 응답 본문을 전달할 때 한 번에 읽고 쓰는 블록의 크기
+#define RELAY_BUFSIZE 65536
+
+// request_body가 알려주는 요청 본문의 길이를 정하는 방식
+// 본문이 없다.
+#define BODY_NONE 0
+// Content-Length 바이트
+#define BODY_LENGTH 1
+// chunked
+#define BODY_CHUNKED 2
+
+// 요청이나 응답 헤더를 이루는 iovec의 최대 개수
+// 요청 라인 4개, Host 3개, 고정 헤더 4개, 빈 줄 1개에 전달하는 헤더마다 4개
+// 응답은 약한 ETag로 바꿀 때 1개, gzip 헤더 2개가 더 붙는다.
+#define IOV_LIST_MAX (HTTP_MAX_HEADERS * 4 + 16)
+
+// 원격 서버에 보낼 요청이나 클라이언트에 보낼 응답 헤더
+// 한 버퍼에 이어 붙이지 않고 상수 문자열, path, 파싱한 헤더 조각을
+// 가리키는 iovec 목록으로 만들어 writev 한 번으로 보낸다.
+// 가리키는 문자열(path, hostname, rio 버퍼)은 보낼 때까지 살아 있어야 한다.
+typedef struct
+{
+  struct iovec iov[IOV_LIST_MAX];
+  int cnt;
+} iov_list;
 
 void *thread(void *vargsp);
+void serve(int listenfd);
+void prefork(int listenfd, int workers);
+pid_t spawn_worker(int listenfd);
 void doit(int connfd);
 void parse_uri(char *uri, char *hostname, char *path, int *port);
-void build_http_header(char *http_header, char *hostname, char *path, int port, rio_t *client_rio);
-int connect_endServer(char *hostname, int port, char *http_header);
+void build_http_header(iov_list *ureq, char *method, char *hostname, char *path, http_req_t *req);
+int request_body(http_req_t *req, ssize_t *len);
+int forward_body(rio_t *rp, int serverfd, int body, ssize_t len);
+void iov_add(iov_list *l, const void *base, size_t len);
+int connect_endServer(char *hostname, int port);
+
+// response relay function
+// gzip 압축 단계
+// 본문을 deflate로 압축해서 클라이언트에게 보내면서 gzip 변형으로 캐시할 응답을 모은다.
+typedef struct
+{
+  z_stream zs;
+  // 압축한 바이트를 보낼 클라이언트 - -1이면 모으기만 한다.
+  int connfd;
+  // gzip 변형의 헤더와 압축한 본문을 모으는 버퍼와 모은 바이트 수
+  char *cachebuf;
+  int sizebuf;
+} gzip_ctx;
+
+int gzip_begin(gzip_ctx *gz, int connfd, char *cachebuf);
+int gzip_write(gzip_ctx *gz, const void *data, size_t n, int finish);
+void gzip_end(gzip_ctx *gz);
+int gzip_type(http_req_t *resp);
+
+void build_resp_header(iov_list *l, http_req_t *resp, int gzip);
+int relay_response(rio_t *server_rio, int connfd, http_req_t *resp, char *cachebuf, int head_only, gzip_ctx *gz);
+int relay_body(rio_t *rp, int connfd, ssize_t len, char *cachebuf, int *sizebuf, gzip_ctx *gz);
+int relay_chunked(rio_t *rp, int connfd, char *cachebuf, int *sizebuf, int reframe, gzip_ctx *gz);
+ssize_t relay_read(rio_t *rp, char *buf, size_t n);
+void cache_append(char *cachebuf, int *sizebuf, const void *data, size_t n);
+
+// CONNECT 터널의 한 방향(클라이언트→서버 또는 서버→클라이언트)
+// splice로 from 소켓에서 파이프로, 파이프에서 to 소켓으로 옮겨서
+// 데이터가 사용자 공간으로 복사되지 않게 한다.
+typedef struct
+{
+  int from, to;
+  // splice 중계용 파이프 - splice를 쓸 수 없으면 -1이고 buf로 read/write 한다.
+  int pipefd[2];
+  char buf[TUNNEL_BUFSIZE];
+  // 파이프나 buf에 들어 있지만 아직 to로 쓰지 못한 바이트와 buf 안의 위치
+  size_t pending, off;
+  // from에서 EOF를 읽었으면 1
+  int eof;
+  // to의 보내는 쪽을 닫았으면(shutdown) 1
+  int shut;
+  // to로 보낸 바이트 수
+  long long bytes;
+} tunnel_dir;
+
+// tunnel function
+void tunnel(int connfd, rio_t *rio, char *target);
+int tunnel_port_allowed(int port);
+int tunnel_fill(tunnel_dir *d);
+int tunnel_flush(tunnel_dir *d);
+ssize_t tunnel_splice(int in, int out, size_t len);
 
 // cache function
-void cache_init();
-int cache_find(char *url);
-void cache_uri(char *uri, char *buf);
+void cache_init(int shared);
+void cache_recover(pid_t pid);
+int cache_find(char *url, int *state);
+int cache_send(int fd, int i, char *url, http_req_t *req);
+int cache_send_gzip(int fd, int i, char *url, http_req_t *req, char *gz_key);
+void cache_uri(char *uri, char *buf, int len);
+int cache_slot(char *uri);
+void cache_remove(int i, char *url);
+
+// background reclaim function
+void reclaim_init();
+void *reclaim_thread(void *vargp);
+void cache_reclaim();
+int cache_free_slot();
+
+// purge function
+int cache_purge(char *url, int prefix);
+int cache_purge_tag(char *tag);
+int open_admin_listenfd(char *port);
+void *admin_thread(void *vargp);
+void *admin_conn_thread(void *vargp);
+void admin_doit(int fd);
 
 void readerPre(int i);
 void readerAfter(int i);
 
+// process-shared lock function
+void shared_mutex_init(pthread_mutex_t *m);
+int shared_lock(pthread_mutex_t *m);
+void shared_unlock(pthread_mutex_t *m);
+
+// negative cache function
+int neg_host_find(char *hostname, int port);
+void neg_lock();
+void neg_host_add(char *hostname, int port, int err);
+int clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
+
+// background refresh function
+void refresh_init();
+void refresh_enqueue(char *url);
+void *refresh_thread(void *vargp);
+void refresh_uri(char *url);
+
 // 캐쉬 블록
 // 개별 캐시 블록의 데이터 상태를 관리한다.
-// 동시성 문제를 처리하기 위해 세마포어를 사용해서
+// 동시성 문제를 처리하기 위해 프로세스 간에 공유되는 뮤텍스를 사용해서
 // 쓰기 및 읽기 연산을 동기화한다.
 typedef struct
 {
-  // 캐시에 저장된 객체의 실제 데이터를 저장하는 버퍼
-  // MAX_OBJECT_SIZE - 캐시 블록당 저장할 수 있는 최대 객체 크기
-  char cache_obj[MAX_OBJECT_SIZE];
+  // 캐시에 저장된 객체의 상태 라인과 헤더 - HEAD에는 여기까지만 보낸다.
+  // 본문은 본문 풀에 따로 두고 body로 가리킨다.
+  char cache_head[CACHE_HEAD_SIZE];
+  // cache_head에 저장된 바이트 수
+  int hdr_len;
+  // 본문 풀의 인덱스 - 본문이 없으면 -1
+  int body;
+  // 조건부 요청을 캐시에서 판단하기 위한 검증자
+  // 응답의 ETag 값(따옴표 포함) - 없거나 너무 길면 빈 문자열
+  char etag[CACHE_ETAG_LEN];
+  // 응답의 Last-Modified 시각 - 없으면 0
+  time_t last_modified;
+  // 조건이 맞을 때 본문 없이 보낼 304 응답 헤더와 그 길이 - 만들지 못했으면 0
+  char nm_head[CACHE_NM_LEN];
+  int nm_len;
+  // 압축하지 않은 text/* 같은 200 응답이라 gzip 변형을 만들 수 있으면 1
+  int gzip_ok;
   // 캐시에 저장된 URL을 저장하는 문자열 버퍼
   // MAXLINE - URL 문자열의 최대 길이를 나타내는 상수
   char cache_url[MAXLINE];
@@ -62,51 +301,196 @@ typedef struct
   // 캐시 블록이 비어 있는지 여부를 나타내는 플래그
   // 1 또는 0 - 비어 있으면 1
   int isEmpty;
+  // 헤더와 본문을 합친 객체의 바이트 수
+  // 바이너리 응답은 중간에 '\0'이 있을 수 있으므로 strlen을 쓰지 않는다.
+  int obj_len;
+  // 원격 서버 응답의 상태 코드
+  // 400 이상이면 네거티브 항목이며 cache_head에는 상태 라인의 사유 문구만 저장한다.
+  int status;
+  // 캐시 블록이 만료되는 시각 - 0이면 만료되지 않는다.
+  time_t expires;
+  // 만료 후 바로 제공하면서 백그라운드에서 갱신할 수 있는 시간(초) - stale-while-revalidate
+  int swr;
+  // 만료 후 원격 서버가 실패할 때 대신 제공할 수 있는 시간(초) - stale-if-error
+  int sie;
+  // 원격 서버가 붙인 태그 목록(Surrogate-Key, Cache-Tag)
+  // " tag1 tag2 " 처럼 공백으로 감싸서 저장해 " tag "로 정확히 찾을 수 있게 한다.
+  char tags[CACHE_TAGS_LEN];
   // 현재 읽기 작업 중인 클라이언트의 수를 저장하는 변수
   int readCnt;
-  // 쓰기 연산을 위한 뮤텍스 세마포어
-  // 캐시 블록에 데이터를 쓰는 동안
-  // 다른 쓰레드가 쓰기 시도하지 못하도록 동시성을 제어하는 데 사용
-  sem_t wmutex;
-  // 현재 읽는 클라이언트의 수를 제어하는 뮤텍스 세마포어
-  // 여러 클라이언트가 동시에 읽기 작업을 수행 시
-  // 값을 업데이트하고 동시성을 제어한다.
-  sem_t rdcntmutex;
+  // 읽는 중인 프로세스와 그 프로세스의 읽기 수
+  // 작업 프로세스가 읽는 도중 죽으면 부모 프로세스가 이 기록으로 readCnt를 되돌린다.
+  pid_t reader_pid[READER_PIDS];
+  int reader_cnt[READER_PIDS];
+  // 블록의 메타데이터와 readCnt를 보호하는 뮤텍스
+  // 쓰는 쪽은 쓰기가 끝날 때까지 잡고 있고, 읽는 쪽은 readCnt를 바꿀 때만 잡는다.
+  // 잡은 프로세스가 죽어도 다음 프로세스가 풀 수 있도록 robust 뮤텍스를 쓴다.
+  pthread_mutex_t lock;
 }cache_block;
 
 
+// DNS 조회 또는 연결에 실패한 호스트 항목
+// 같은 호스트로의 요청이 짧은 시간 동안 resolver와 원격 서버를 다시 두드리지 않도록 한다.
+typedef struct
+{
+  // 실패한 호스트 이름
+  char hostname[MAXLINE];
+  // 실패한 포트 번호
+  int port;
+  // open_clientfd의 반환값 - -2면 DNS 조회 실패, -1이면 연결 실패
+  int err;
+  // 항목이 만료되는 시각 - 0이면 빈 항목
+  time_t expires;
+}neg_host;
+
+
+// 백그라운드 갱신 작업 항목
+// 같은 URL의 갱신이 동시에 두 번 이상 진행되지 않도록
+// 대기 중이거나 진행 중인 URL을 모두 이 테이블에 둔다.
+typedef struct
+{
+  char url[MAXLINE];
+  // 0이면 빈 항목, 1이면 대기 중, 2면 갱신 스레드가 진행 중
+  int state;
+  // 진행 중인 작업을 맡은 프로세스 - 그 프로세스가 죽으면 항목을 비운다.
+  pid_t owner;
+}refresh_job;
+
+typedef struct
+{
+  refresh_job jobs[REFRESH_QUEUE_SIZE];
+  // 테이블 전체를 보호하는 뮤텍스
+  pthread_mutex_t mutex;
+  // 대기 중인 작업의 수 - 갱신 스레드는 이 세마포어에서 기다린다.
+  sem_t items;
+}refresh_queue;
+
+// URL 색인 항목 - URL 순서로 정렬되어 있어서
+// 접두사가 같은 URL들이 색인에서 연속된 구간을 이룬다.
+typedef struct
+{
+  // 캐시 블록의 URL 사본
+  // 블록의 쓰기 잠금 없이 색인 뮤텍스만으로 비교할 수 있도록 따로 가진다.
+  char url[MAXLINE];
+  // 캐시 블록 인덱스
+  int slot;
+}url_entry;
+
+// 본문 풀의 한 칸
+// 내용의 해시로 찾고, 이 본문을 가리키는 캐시 블록의 수를 센다.
+// 채운 뒤에는 바꾸지 않으므로 블록의 읽기 잠금만 잡고 읽을 수 있다.
+typedef struct
+{
+  // 본문 내용의 해시 - 해시가 같으면 길이와 내용까지 비교한다.
+  unsigned long long hash;
+  int len;
+  // 이 본문을 가리키는 캐시 블록의 수 - 0이면 빈 칸
+  int refcnt;
+  char data[MAX_OBJECT_SIZE];
+}cache_body;
+
 // 캐쉬 구조체 정의
+// prefork 모드에서는 공유 메모리에 올라가서 모든 작업 프로세스가 함께 쓰므로
+// 포인터 없이 고정 크기 배열과 인덱스만으로 구성한다.
 typedef struct
 {
   cache_block cacheobjs[CACHE_OBJS_COUNT];
+  // 사용 중인 캐시 블록의 수
   int cache_num;
+  // 사용 중인 본문의 수
+  int body_num;
+  // 실제로 저장된 바이트 수 - 블록의 헤더와 본문 풀의 본문(함께 쓰는 본문은 한 번)
+  int cache_bytes;
+  // cache_num, body_num, cache_bytes를 보호하는 뮤텍스
+  pthread_mutex_t usage_mutex;
+  // 본문 풀
+  cache_body bodies[CACHE_BODY_COUNT];
+  // 새 본문을 저장하는 대신 이미 있는 본문을 함께 쓴 횟수
+  long long dedup_hits;
+  // 본문 풀의 refcnt, dedup_hits를 보호하는 뮤텍스
+  // 블록의 뮤텍스를 잡은 채 잡을 수 있고, 이 뮤텍스를 잡은 채 블록의 뮤텍스를 잡지는 않는다.
+  pthread_mutex_t body_mutex;
+  // 회수 스레드를 깨우는 세마포어와 이미 깨웠는지 나타내는 플래그
+  sem_t reclaim_wake;
+  int reclaim_pending;
+  // 비어 있지 않은 캐시 블록의 URL 색인 - url 오름차순
+  url_entry url_index[CACHE_OBJS_COUNT];
+  // 색인에 들어 있는 항목의 수
+  int url_index_cnt;
+  // URL 색인을 보호하는 뮤텍스
+  pthread_mutex_t index_mutex;
+  // DNS 조회 또는 연결에 실패한 호스트 테이블
+  neg_host neg_hosts[NEG_HOST_COUNT];
+  // 실패한 호스트 테이블 전체를 보호하는 뮤텍스
+  pthread_mutex_t neg_mutex;
+  // 백그라운드 갱신 작업 테이블
+  refresh_queue refresh;
+  // 블록의 쓰기 잠금부터 색인, 사용량 반영까지(쓰기 구간) 진행 중인 작업의 수
+  // cache_recover는 구간을 닫고 이 수가 0이 된 뒤에만 블록 상태로부터 다시 센다.
+  int write_active;
+  int write_closed;
+  // 프로세스별로 쓰기 구간 안에 있는 작업의 수 - 죽은 프로세스의 몫을 찾는 데 쓴다.
+  pid_t write_pid[READER_PIDS];
+  int write_cnt[READER_PIDS];
+  // write_active, write_closed, write_pid, write_cnt를 보호하는 뮤텍스
+  pthread_mutex_t write_mutex;
 }Cache;
 
-Cache cache;
+// 캐시 - 스레드 모드에서는 프로세스 메모리, prefork 모드에서는 공유 메모리를 가리킨다.
+Cache *cache;
+// 현재 프로세스의 pid - 캐시 블록의 읽기 기록에 사용한다.
+pid_t cache_pid;
+// 관리용 듣기 소켓 - 작업 프로세스는 물려받은 것을 닫는다.
+int admin_listenfd = -1;
+
+int cache_state(cache_block *cb, time_t now);
+int cache_send_mode(cache_block *cb, http_req_t *req);
+void index_set(int slot, char *url);
+void index_insert_locked(int slot, char *url);
+void index_del(int slot);
+void pid_track(pid_t *pids, int *cnts, pid_t pid, int delta);
+int pid_take(pid_t *pids, int *cnts, pid_t pid);
+void write_enter();
+void write_leave();
+void cache_rebuild();
+void cache_usage(int bytes, int objs, int bodies);
+int cache_evict_lru();
+unsigned long long body_hash(const char *p, size_t n);
+int body_find(unsigned long long hash, const char *data, int len);
+int body_available(unsigned long long hash, const char *data, int len);
+int body_acquire(unsigned long long hash, const char *data, int len, int *new_bytes);
+int body_release(int slot);
+void cache_stats(char *buf, size_t size);
+int build_not_modified(http_req_t *resp, char *dst, int size);
+
 
 int main(int argc, char **argv) {
-  // 프록시 듣기 식별자, 프록시 연결 식별자
-  int listenfd, connfd;
-  // 클라이언트에게 받은 uil 정보를 담을 공간
-  char hostname[MAXLINE], port[MAXLINE];
-  // 소켓 길이를 저장할 구조체
-  socklen_t clientlen;
+  // 프록시 듣기 식별자
+  int listenfd;
+  // prefork 모드의 작업 프로세스 수 - 0이면 한 프로세스 안에서 스레드만 쓴다.
+  int workers = 0, opt;
   pthread_t tid;
-  // 소켓 구조체 - clientaddress
-  struct sockaddr_storage clientaddr;
-
-  // 캐쉬 초기화
-  cache_init();
 
   /* Check command line args */
   // 명령줄 인수를 확인하여 서버가 사용할 포트 번호를 결정
   // 포트 번호를 받지 않으면 사용법을 출력하고 프로그램을 종료
-  // 입력인자가 2개인지 확인
-  if (argc != 2) {
-    fprintf(stderr, "usage: %s <port> \n", argv[0]);
+  // -w 옵션을 빼고 입력인자가 1개(관리 포트를 주면 2개)인지 확인
+  while ((opt = getopt(argc, argv, "w:")) != -1)
+  {
+    if (opt == 'w')
+      workers = atoi(optarg);
+    else
+      workers = -1;
+  }
+  if ((argc - optind != 1 && argc - optind != 2) || workers < 0 || workers > PREFORK_MAX) {
+    fprintf(stderr, "usage: %s [-w workers(1-%d)] <port> [admin port]\n", argv[0], PREFORK_MAX);
     exit(1);
   }
 
+  // 캐쉬 초기화
+  // 작업 프로세스를 띄울 때는 캐시를 공유 메모리에 둔다.
+  cache_init(workers > 0);
+
   // 프로세스가 SIGPIPE 신호를 무시하도록 설정하는 역할
   // 한 프로세스가 소켓 등의 통신 매체를 통해 데이터를 보내려고 시도하지만
   // 데이터를 읽는 프로세스가 이미 종료된 경우 발생하는 시그널을 처리한다.
@@ -114,31 +498,118 @@ int main(int argc, char **argv) {
 
   // 서버 소켓을 연다.
   // 지정된 포트 번호에서 클라이언트의 연결을 수신하기 위한 소켓 생성 후 반환
-  listenfd = Open_listenfd(argv[1]);
+  listenfd = Open_listenfd(argv[optind]);
+
+  // prefork 모드 - 작업 프로세스들이 같은 듣기 소켓에서 연결을 수락한다.
+  // 부모 프로세스는 관리 포트만 처리하고 죽은 작업 프로세스를 되살린다.
+  if (workers > 0)
+  {
+    int i;
+    for (i = 0; i < workers; i++)
+      spawn_worker(listenfd);
+  }
+  else
+  {
+    // 백그라운드 갱신 스레드 시작
+    refresh_init();
+    // 백그라운드 회수 스레드 시작
+    reclaim_init();
+  }
+
+  // 관리 포트가 주어지면 루프백 주소에서만 PURGE 요청을 받는 스레드를 시작한다.
+  if (argc - optind == 2)
+  {
+    if ((admin_listenfd = open_admin_listenfd(argv[optind + 1])) < 0)
+    {
+      fprintf(stderr, "couldn't open admin port %s\n", argv[optind + 1]);
+      exit(1);
+    }
+    Pthread_create(&tid, NULL, admin_thread, (void *)(long)admin_listenfd);
+  }
+
+  if (workers > 0)
+    prefork(listenfd, workers);
+  else
+    serve(listenfd);
+  return 0;
+}
+
+// 웹 서버의 핵심 로직
+// 무한 루프를 실행하여 클라이언트의 연결을 수락하고 처리
+void serve(int listenfd)
+{
+  // 프록시 연결 식별자
+  int connfd;
+  // 클라이언트에게 받은 uil 정보를 담을 공간
+  char hostname[MAXLINE], port[MAXLINE];
+  // 소켓 길이를 저장할 구조체
+  socklen_t clientlen;
+  pthread_t tid;
+  // 소켓 구조체 - clientaddress
+  struct sockaddr_storage clientaddr;
 
-  // 웹 서버의 핵심 로직
-  // 무한 루프를 실행하여 클라이언트의 연결을 수락하고 처리
   while (1) {
     clientlen = sizeof(clientaddr);
     // 클라이언트의 연결을 수락
     // 수락된 연결 소켓 connfd를 반환한다.
     // 소켓 어드레스(SA) - 포트 번호는 서버가 정하고 있고 사용자가 주소를 입력 시 가져와서 비교 후 수락을 시도한다. 
-    connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);  // line:netp:tiny:accept
+    // 여러 작업 프로세스가 같은 소켓에서 수락하므로 실패해도 종료하지 않는다.
+    if ((connfd = accept(listenfd, (SA *)&clientaddr, &clientlen)) < 0)
+      continue;
     // Getnameinfo를 호출하여 클라이언트의 IP 주소를
     // 호스트 이름과 포트 번호로 변환하고, 호스트 이름과 포트 번호를 출력
     Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
     printf("Accepted connection from (%s %s).\n", hostname, port);
 
     // 쓰레드 식별자, 쓰레드 특성, 쓰레드 함수, 쓰레드 함수 매개변수
-    Pthread_create(&tid, NULL, thread, (void *)connfd);
+    Pthread_create(&tid, NULL, thread, (void *)(long)connfd);
+  }
+}
+
+// 작업 프로세스를 띄운다.
+// 작업 프로세스는 자신의 갱신, 회수 스레드를 시작하고 연결을 수락한다.
+pid_t spawn_worker(int listenfd)
+{
+  pid_t pid;
+
+  if ((pid = Fork()) == 0)
+  {
+    cache_pid = getpid();
+    if (admin_listenfd >= 0)
+      Close(admin_listenfd);
+    refresh_init();
+    reclaim_init();
+    serve(listenfd);
+    exit(0);
+  }
+  return pid;
+}
+
+// prefork 모드의 부모 프로세스
+// 작업 프로세스가 죽으면 그 프로세스가 잡고 있던 캐시 블록을 되돌리고 새로 띄운다.
+void prefork(int listenfd, int workers)
+{
+  pid_t pid;
+  int status;
+
+  while (1)
+  {
+    if ((pid = waitpid(-1, &status, 0)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      unix_error("waitpid error");
+    }
+    fprintf(stderr, "worker %d exited, recovering cache\n", (int)pid);
+    cache_recover(pid);
+    spawn_worker(listenfd);
   }
-  return 0;
 }
 
 // 스레드를 생성하고 실행하는 함수
 void *thread(void *vargsp) {
   // 클라이언트와의 연결을 나타내는 파일 디스크립터(소켓)
-  int connfd = (int)vargsp;
+  int connfd = (int)(long)vargsp;
   // 현재 스레드를 분리한다(detach)
   // 스레드를 분리하면 해당 스레드가 종료 시 스스로 리소스를 정리한다.
   // 메인 스레드나 다른 스레드와 독립적으로 실행되는 스레드의 경우
@@ -147,6 +618,7 @@ void *thread(void *vargsp) {
   doit(connfd);
   // 클라이언트와 연결 종료
   Close(connfd);
+  return NULL;
 }
 
 // 프록시 서버의 핵심 로직
@@ -156,10 +628,10 @@ void *thread(void *vargsp) {
 void doit(int connfd) {
   // 원결 서버와의 통신을 위한 소켓 파일 디스크립터를 저장할 변수
   int end_serverfd;
-  // 버퍼와 HTTP 요청 메서드, URI, 버전을 저장할 변수
-  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-  // 원격 서버에 보낸 HTTP 헤더를 저장할 변수
-  char endserver_http_header[MAXLINE];
+  // HTTP 요청 메서드와 URI를 저장할 변수
+  char method[MAXLINE], uri[MAXLINE];
+  // 원격 서버에 보낼 요청 - 조각들을 가리키는 iovec 목록
+  iov_list endserver_req;
   // URI의 호스트 이름과 경로를 저장할 변수
   char hostname[MAXLINE], path[MAXLINE];
   // 원격 서버의 포트 번호를 저장할 변수
@@ -168,24 +640,73 @@ void doit(int connfd) {
   rio_t rio;
   // 입출력 서버 버퍼 구조체 선언
   rio_t server_rio;
+  // 파싱한 요청 라인과 헤더 - rio 버퍼 안을 가리키는 조각들
+  http_req_t req;
+  int rc;
+  // 본문을 전달하는 메서드(POST, PUT, PATCH, DELETE)면 1
+  int unsafe;
+  // HEAD면 1 - 캐시에서는 헤더만 보내고, 원격 서버의 응답은 본문이 없으므로 캐시하지 않는다.
+  int head;
+  // 요청 본문의 길이를 정하는 방식(BODY_*)과 Content-Length
+  int body;
+  ssize_t body_len = 0;
 
   // 클라이언트와의 통신을 위한 소켓 파일 디스크립터를 받는다. 
   Rio_readinitb(&rio, connfd);
-  // 요청 라인을 읽고 HTTP 요청 메소드, URI, 버전을 파싱한다.
-  Rio_readlineb(&rio, buf, MAXLINE);
+  // 요청 라인과 헤더를 rio 버퍼 안에서 복사 없이 한 번에 파싱한다.
+  http_req_init(&req);
+  if ((rc = http_read_request(&rio, &req)) != HTTP_PARSE_DONE)
+  {
+    // 헤더가 rio 버퍼보다 크면 431, 형식이 잘못됐으면 400, 요청 도중에 시간 제한이 지났으면 408을 보내고
+    // 요청 없이 끊겼으면(HTTP_PARSE_EOF) 조용히 끝낸다.
+    if (rc == HTTP_PARSE_TOOBIG)
+      clienterror(connfd, "", "431", "Request Header Fields Too Large", "Proxy couldn't buffer the request header");
+    else if (rc == HTTP_PARSE_ERROR)
+      clienterror(connfd, "", "400", "Bad Request", "Proxy couldn't parse the request");
+    else if (rc == HTTP_PARSE_AGAIN && rio.rio_cnt > 0)
+      clienterror(connfd, "", "408", "Request Timeout", "Proxy timed out waiting for the request");
+    return;
+  }
 
-  // 클라이언트의 요청 라인을 읽는다.
-  sscanf(buf, "%s %s %s", method, uri, version);
+  // CONNECT host:port - 원격 서버와 연결한 뒤 양쪽 바이트를 그대로 중계한다.
+  if (http_slice_eq(&req.method, "CONNECT")) {
+    if (http_slice_copy(&req.target, uri, MAXLINE) < 0) {
+      clienterror(connfd, "", "414", "URI Too Long", "Proxy couldn't buffer the request URI");
+      return;
+    }
+    // 헤더는 쓰지 않지만 버퍼에서 소비해야 뒤이어 온 데이터를 터널로 넘길 수 있다.
+    http_req_consume(&rio, &req);
+    tunnel(connfd, &rio, uri);
+    return;
+  }
 
-  // 요청 메서드가 GET이 아닌 경우
+  // 요청 메서드가 GET도 아니고 본문을 전달하는 메서드도 아닌 경우
   // 프록시 서버가 해당 메서드를 지원하지 않음을 알리고 함수를 종료합니다.
-  if (strcasecmp(method, "GET")) {
-    printf("Proxy does not implement the method");
+  // POST, PUT, PATCH, DELETE는 캐시를 거치지 않고 원격 서버로 보내며 응답도 캐시하지 않는다.
+  if (http_slice_copy(&req.method, method, MAXLINE) < 0)
+    method[0] = '\0';
+  unsafe = !strcmp(method, "POST") || !strcmp(method, "PUT")
+        || !strcmp(method, "PATCH") || !strcmp(method, "DELETE");
+  head = !strcmp(method, "HEAD");
+  if (strcmp(method, "GET") && !head && !unsafe) {
+    clienterror(connfd, method, "501", "Not Implemented", "Proxy does not implement this method");
+    return;
+  }
+
+  // 본문의 끝을 알 수 없는 요청은 원격 서버로 넘기지 않는다.
+  if ((body = request_body(&req, &body_len)) < 0) {
+    clienterror(connfd, method, "400", "Bad Request", "Proxy couldn't determine the request body length");
+    return;
+  }
+
+  // parse_uri가 문자열을 고쳐 쓰므로 요청 대상만 uri로 복사한다.
+  if (http_slice_copy(&req.target, uri, MAXLINE) < 0) {
+    clienterror(connfd, "", "414", "URI Too Long", "Proxy couldn't buffer the request URI");
     return;
   }
 
   // 클라이언트의 요청 URI를 임시로 저장할 변수를 선언합니다.
-  char url_store[100];
+  char url_store[MAXLINE];
 
   // uri에 저장된 클라이언트의 요청 URI를 url_store에 복사해서
   // 나중에 캐시 검사에서 사용할 수 있도록 한다.
@@ -193,409 +714,2582 @@ void doit(int connfd) {
   // 캐시 시스템에 이후에 해당 uri를 찾고 캐시된 데이터를 반환한다.
   strcpy(url_store, uri);
 
-  int cache_index;
+  int cache_index, cache_state;
+  // 원격 서버가 실패했을 때 대신 제공할 만료된 캐시 블록 - 없으면 -1
+  int stale_index = -1;
+
+  // 클라이언트가 gzip을 받으면 gzip 변형의 캐시 키를 만든다.
+  char gz_key[MAXLINE];
+  int gz_ok = !unsafe && http_accepts_gzip(&req) && strlen(url_store) + strlen(CACHE_GZIP_SUFFIX) < MAXLINE;
+  if (gz_ok)
+    strcat(strcpy(gz_key, url_store), CACHE_GZIP_SUFFIX);
+
   // 캐시 검사
-  // 요청된 URI의 캐시를 검색한다.
-  if ((cache_index=cache_find(url_store)) != -1)
-  {
-    // 캐시가 존재하는 경우
-    // 해당 캐시를 클라이언트에게 전송하고
-    // 함수를 종료한다.
-    readerPre(cache_index);
-    // 클라이언트에게 캐시된 데이터를 전송한다.
-    // 소켓 파일 디스크립터, 캐시 블록에서 읽은 데이터, 캐시 블록 데이터의 길이
-    Rio_writen(connfd, cache.cacheobjs[cache_index].cache_obj, strlen(cache.cacheobjs[cache_index].cache_obj));
-    // 캐시 블록에 대한 읽기 작업을 완료하고 동기화를 해제 또는 정리 작업
-    readerAfter(cache_index);
+  // gzip 변형이 있으면 그것을 보낸다. 만료된 변형이면 원래 URL을 갱신한다.
+  // 클라이언트에게 쓰지 못했으면(-1) 응답 전달에 실패한 것과 같이 더 하지 않고 끝낸다.
+  if (gz_ok && (cache_index=cache_find(gz_key, &cache_state)) != -1
+      && cache_state != CACHE_STALE_ERROR && (rc = cache_send(connfd, cache_index, gz_key, &req)) != 0)
+  {
+    if (rc > 0 && cache_state == CACHE_STALE)
+      refresh_enqueue(url_store);
     return;
   }
+  // 요청된 URI의 캐시를 검색한다. 본문을 전달하는 메서드는 항상 원격 서버로 보낸다.
+  if (!unsafe && (cache_index=cache_find(url_store, &cache_state)) != -1)
+  {
+    // 신선하거나 stale-while-revalidate 기간 안이면
+    // 해당 캐시를 클라이언트에게 전송하고 함수를 종료한다.
+    // gzip을 받는 클라이언트에게는 한 번 압축해서 보내고 그 결과를 gzip 변형으로 캐시한다.
+    if (cache_state != CACHE_STALE_ERROR
+        && ((gz_ok && (rc = cache_send_gzip(connfd, cache_index, url_store, &req, gz_key)) != 0)
+            || (rc = cache_send(connfd, cache_index, url_store, &req)) != 0))
+    {
+      // 만료된 블록을 제공했으면 백그라운드에서 갱신한다.
+      if (rc > 0 && cache_state == CACHE_STALE)
+        refresh_enqueue(url_store);
+      return;
+    }
+    // stale-if-error 기간 안이면 원격 서버가 실패할 때를 대비해 기억해 둔다.
+    if (cache_state == CACHE_STALE_ERROR)
+      stale_index = cache_index;
+  }
   
   // 요청된 URI를 파싱하여 호스트 이름, 경로 및 포트 번호를 추출한다.
   parse_uri(uri, hostname, path, &port);
 
   // 원격 서버에 전송할 HTTP 헤더를 생성한다.
-  build_http_header(endserver_http_header, hostname, path, port, &rio);
+  build_http_header(&endserver_req, method, hostname, path, &req);
+
+  // 최근에 DNS 조회나 연결에 실패한 호스트라면
+  // resolver와 원격 서버를 다시 두드리지 않고 바로 오류를 응답한다.
+  // 대신 제공할 만료된 블록이 있으면 그것을 응답한다.
+  int neg_err;
+  if ((neg_err = neg_host_find(hostname, port)) != 0)
+  {
+    if (stale_index != -1 && cache_send(connfd, stale_index, url_store, &req))
+      return;
+    if (neg_err == -2)
+      clienterror(connfd, hostname, "502", "Bad Gateway", "Proxy couldn't resolve the end server (cached)");
+    else
+      clienterror(connfd, hostname, "502", "Bad Gateway", "Proxy couldn't connect to the end server (cached)");
+    return;
+  }
 
   // 원격 서버에 연결한다
-  end_serverfd = connect_endServer(hostname, port, endserver_http_header);
-  // 연결에 실패하면 함수를 종료한다.
+  end_serverfd = connect_endServer(hostname, port);
+  // 연결에 실패하면 실패한 호스트를 기억하고 오류를 응답한다.
   if (end_serverfd < 0)
   {
-    printf("connection failed\n");
+    neg_host_add(hostname, port, end_serverfd);
+    if (stale_index != -1 && cache_send(connfd, stale_index, url_store, &req))
+      return;
+    if (end_serverfd == -2)
+      clienterror(connfd, hostname, "502", "Bad Gateway", "Proxy couldn't resolve the end server");
+    else
+      clienterror(connfd, hostname, "502", "Bad Gateway", "Proxy couldn't connect to the end server");
     return;
   }
 
   // 원격 서버와의 통신을 위해 server_rio 버퍼를 초기화한다.
   Rio_readinitb(&server_rio, end_serverfd);
 
-  // 생성된 HTTP 헤더를 원격 서버에 전송한다.
-  Rio_writen(end_serverfd, endserver_http_header, strlen(endserver_http_header));
+  // 생성된 HTTP 요청을 writev로 한 번에 원격 서버에 전송한다.
+  // 원격 서버가 연결을 받자마자 끊었으면 응답을 받지 못한 것과 같이 처리한다.
+  if (rio_writev(end_serverfd, endserver_req.iov, endserver_req.cnt) < 0)
+  {
+    Close(end_serverfd);
+    if (stale_index != -1 && cache_send(connfd, stale_index, url_store, &req))
+      return;
+    clienterror(connfd, hostname, "502", "Bad Gateway", "Proxy couldn't send the request to the end server");
+    return;
+  }
+
+  // 헤더 조각을 다 보냈으니 rio 버퍼에서 헤더를 소비하고 본문을 이어서 보낸다.
+  // 클라이언트가 Expect: 100-continue로 기다리고 있으면 프록시가 먼저 100으로 답한다.
+  http_req_consume(&rio, &req);
+  if (body != BODY_NONE)
+  {
+    http_slice_t *expect = http_req_header(&req, HDR_EXPECT);
+    if (expect != NULL && http_slice_eq(&req.version, "HTTP/1.1")
+        && expect->len == 12 && !strncasecmp(expect->ptr, "100-continue", 12)
+        && rio_writen(connfd, (void *)continue_resp, strlen(continue_resp)) < 0)
+    {
+      Close(end_serverfd);
+      return;
+    }
+    // 본문을 끝까지 보내지 못했으면 원격 서버가 나머지를 기다리지 않도록 쓰기 쪽을 닫는다.
+    // 원격 서버가 먼저 응답하고 끊은 경우(413 등)에는 그 응답을 그대로 전달한다.
+    if (forward_body(&rio, end_serverfd, body, body_len) < 0)
+      shutdown(end_serverfd, SHUT_WR);
+  }
 
   // 캐시에 저장할 데이터를 임시로 저장하기 위한 문자열 버퍼
   char cachebuf[MAX_OBJECT_SIZE];
-  int sizebuf = 0;
-  size_t n;
-  
-  // 원격 서버로부터 데이터를 읽는 루프
-  // Rio_readlineb 함수를 사용해서 원격 서버로부터 한 줄씩 데이터를 읽고
-  while ((n=Rio_readlineb(&server_rio, buf, MAXLINE)) != 0)
-  {
-    // 읽은 데이터의 크기를 n에 저장
-    sizebuf += n;
-    // 동시에 데이터를 cachebuf에 저장
-    if (sizebuf < MAX_OBJECT_SIZE)
-      // cachebuf에 원격 서버에서 읽은 데이터를 누적시킨다.
-      strcat(cachebuf, buf);
-    // 원격 서버로부터 데이터를 읽어 클라이언트에게 전송
-    Rio_writen(connfd, buf, n);
+  int sizebuf;
+  // 원격 서버 응답의 상태 라인과 헤더
+  http_req_t resp;
+
+  // 상태 라인과 헤더를 먼저 파싱한다.
+  // 100 Continue 같은 1xx 중간 응답은 건너뛴다.
+  http_resp_init(&resp);
+  rc = http_read_response(&server_rio, &resp);
+  while (rc == HTTP_PARSE_DONE && resp.status >= 100 && resp.status < 200)
+  {
+    http_req_consume(&server_rio, &resp);
+    http_resp_init(&resp);
+    rc = http_read_response(&server_rio, &resp);
+  }
+  // 원격 서버가 올바른 응답을 보내지 않거나 5xx를 보내면 클라이언트에게 아무것도 보내기 전에
+  // 만료된 블록으로 대신 응답할 수 있다.
+  if (rc != HTTP_PARSE_DONE || (stale_index != -1 && resp.status >= 500))
+  {
+    Close(end_serverfd);
+    if (stale_index != -1 && cache_send(connfd, stale_index, url_store, &req))
+      return;
+    clienterror(connfd, hostname, "502", "Bad Gateway", "Proxy got no valid response from the end server");
+    return;
+  }
+
+  // gzip을 받는 클라이언트에게 텍스트 계열 응답을 보낼 때는 압축 단계를 거친다.
+  // 압축한 응답은 gzbuf에 따로 모아서 압축하지 않은 응답과 함께 캐시한다.
+  gzip_ctx gz;
+  char *gzbuf = NULL;
+  if (gz_ok && !head && gzip_type(&resp))
+  {
+    gzbuf = Malloc(MAX_OBJECT_SIZE);
+    if (gzip_begin(&gz, connfd, gzbuf) < 0)
+    {
+      Free(gzbuf);
+      gzbuf = NULL;
+    }
   }
+
+  // 응답 헤더를 보내고 본문은 Content-Length, chunked, 연결 종료 중
+  // 응답이 알려 준 방식대로 큰 블록 단위로 전달하면서 cachebuf에 모은다.
+  sizebuf = relay_response(&server_rio, connfd, &resp, (unsafe || head) ? NULL : cachebuf, head,
+                           gzbuf != NULL ? &gz : NULL);
   // 원격 서버와의 통신이 완료되면 연결을 닫는다.
   Close(end_serverfd);
 
-  // 데이터 크기가 MAX_OBJECT_SIZE를 초과하지 않으면
-  if (sizebuf < MAX_OBJECT_SIZE)
+  // 상태를 바꾸는 요청이 성공했으면 같은 URI의 캐시 블록은 더 이상 맞지 않으므로 비운다(RFC 7234 4.4).
+  // 응답 자체는 캐시하지 않는다.
+  if (unsafe)
   {
-    // cache_uri 함수를 호출하여 데이터를 캐시에 저장한다.
-    cache_uri(url_store, cachebuf);
+    if (resp.status >= 200 && resp.status < 400)
+      cache_purge(url_store, 0);
+    return;
   }
-}
-
-// HTTP 헤더를 구성하는 함수
-// 호스트 이름, 경로, 포트 번호 및 클라이언트로부터 받은 헤더 정보를 사용해서
-// 완전한 HTTP 요청 헤더를 생성한다.
-void build_http_header(char *http_header, char *hostname, char *path, int port, rio_t *client_rio) 
-{
-  // 버퍼, 요청 라인, 다른 헤더, 호스트 헤더를 선언한다.
-  char buf[MAXLINE], request_hdr[MAXLINE], other_hdr[MAXLINE], host_hdr[MAXLINE];
-  
-  // 요청 라인를 생성한다.
-  // requestline_hdr_format - 요청 라인의 포맷 문자열 포함
-  // path - 요청할 자원의 경로
-  sprintf(request_hdr, requestline_hdr_format, path);
+  if (head)
+    return;
 
-  // 클라이언트로부터 헤더 라인을 읽는다.
-  // Rio_readlineb - 한 라인씩 읽는다.
-  while (Rio_readlineb(client_rio, buf, MAXLINE) > 0) 
+  // 응답을 끝까지 받았고 데이터 크기가 MAX_OBJECT_SIZE를 초과하지 않으면
+  if (sizebuf >= 0 && sizebuf < MAX_OBJECT_SIZE)
   {
-    // endof_hdr 문자열일 경우 루프 종료한다.
-    if (strcmp(buf, endof_hdr) == 0)
-      break;
-    
-    // 헤더 라인을 분석하고 필요한 정보를 추출한다.
-    if (!strncasecmp(buf, host_key, strlen(host_key)))
+    // 상태 라인과 캐시 관련 헤더를 확인할 수 있도록 문자열로 끝낸다.
+    cachebuf[sizebuf] = '\0';
+    // cache_uri 함수를 호출하여 데이터를 캐시에 저장한다.
+    cache_uri(url_store, cachebuf, sizebuf);
+    // 압축한 응답도 캐시에 들어가는 크기면 gzip 변형으로 저장한다.
+    if (gzbuf != NULL && gz.sizebuf < MAX_OBJECT_SIZE)
     {
-      // 호스트 헤더를 찾아서 저장한다.
-      strcpy(host_hdr, buf);
-      continue;
+      gzbuf[gz.sizebuf] = '\0';
+      cache_uri(gz_key, gzbuf, gz.sizebuf);
     }
-    // 헤더 라인을 분석하고 필요한 정보를 추출한다.
-    // Connection, Proxy-Connection, User-Agent 제외한 나머지 헤더를
-    // other_hdr에 추가하는 부분을 나타낸다.
-    // strncasecmp(buf, connection_key, strlen(connection_key) - 현재 읽은 헤더 라인 buf와 connection_key를 대소문자 구분 없이 비교
-    // strncasecmp(buf, proxy_connection_key, strlen(proxy_connection_key)) - 현재 읽은 헤더 라인 버퍼와 proxy_connection_key를 대소문자 구분 없이 비교
-    // strncasecmp(buf, user_agent_key, strlen(user_agent_key)) - 현재 읽은 헤더 라인 버퍼와, user)agent_key를 대소문자 구분 없이 비교
-    if (strncasecmp(buf, connection_key, strlen(connection_key))
-        &&strncasecmp(buf, proxy_connection_key, strlen(proxy_connection_key))
-        &&strncasecmp(buf, user_agent_key, strlen(user_agent_key)))
-        {
-        // HTTP 요청 헤더에서 특정 헤더 필드를 필터링하고
-        // 나머지 헤더 필드를 other_hdr에 추가
-        strcat(other_hdr, buf);
-      }
   }
-  // 호스트 헤더가 없을 경우
-  if (strlen(host_hdr) == 0) {
-    // 호스트 헤더를 생성한다.
-    sprintf(host_hdr, host_hdr_format, hostname);
-  }
-  // 최종 HTTP 헤더를 생성한다.
-  // %s 포맷 문자열을 사용해서 각각의 헤더 부분을 합니다.
-  // 생성된 헤더는 http_header 문자열에 저장된다.
-  sprintf(http_header, "%s%s%s%s%s%s%s",
-          request_hdr,
-          host_hdr,
-          conn_hdr,
-          prox_hdr,
-          user_agent_hdr,
-          other_hdr,
-          endof_hdr);
-  return;
+  if (gzbuf != NULL)
+  {
+    gzip_end(&gz);
+    Free(gzbuf);
+  }
 }
 
-// 원격 서버에 연결하기 위한 함수
-// 호스트 이름, 포트 번호, HTTP 요청 헤더를 사용하여
-// 원격 서버에 연결하고 연결된 소켓 파일 디스크립터를 반환한다.
-inline int connect_endServer(char *hostname, int port, char *http_header)
+// 클라이언트에 보낼 응답 헤더를 iovec 목록으로 만든다.
+// 상태 라인과 헤더는 원격 서버 응답의 조각을 그대로 가리키고,
+// 홉 단위 헤더와 Connection에 적힌 헤더는 빼고 Connection: close를 붙인다.
+// chunked 본문은 풀어서 보내므로 Transfer-Encoding과 함께 온 Content-Length도 뺀다.
+// gzip이면 본문을 압축해서 보내므로 Content-Length를 빼고 Content-Encoding과 Vary를 붙인다.
+// 같은 ETag가 두 표현을 가리키지 않도록 강한 ETag는 약한 ETag로 바꾼다.
+void build_resp_header(iov_list *l, http_req_t *resp, int gzip)
 {
-  // 문자열 형태로 포트 번호를 저장하기 위한 버퍼
-  char portStr[100];
-  // 호스트와 연결 시 포트 번호를 문자열 형태로 사용한다.
-  // 정수형 포트 번호를 문자열로 변환한다.
-  sprintf(portStr, "%d", port);
-  // 변환된 포트 번호를 사용해서 호스트에 연견한다.
-  // 호스트와 연결된 소켓 파일 디스크립터를 반환한다.
-  // 연결 실패 시 음수 값을 반환한다.
-  return Open_clientfd(hostname, portStr);
+  http_header_t *h;
+  int i, chunked = http_req_header(resp, HDR_TRANSFER_ENCODING) != NULL;
+
+  l->cnt = 0;
+  // 상태 라인 - 버전부터 사유 문구 끝까지
+  iov_add(l, resp->version.ptr, resp->reason.ptr + resp->reason.len - resp->version.ptr);
+  iov_add(l, endof_hdr, strlen(endof_hdr));
+  for (i = 0; i < resp->nheaders; i++)
+  {
+    h = &resp->headers[i];
+    if (HDR_IS_HOP(h->id) || ((chunked || gzip) && h->id == HDR_CONTENT_LENGTH))
+      continue;
+    if (resp->hdr_index[HDR_CONNECTION] != -1 && http_conn_listed(resp, &h->name))
+      continue;
+    iov_add(l, h->name.ptr, h->name.len);
+    iov_add(l, hdr_sep, strlen(hdr_sep));
+    if (gzip && h->id == HDR_ETAG && !(h->value.len >= 2 && !strncmp(h->value.ptr, weak_etag, 2)))
+      iov_add(l, weak_etag, strlen(weak_etag));
+    iov_add(l, h->value.ptr, h->value.len);
+    iov_add(l, endof_hdr, strlen(endof_hdr));
+  }
+  if (gzip)
+  {
+    iov_add(l, gzip_ce_hdr, strlen(gzip_ce_hdr));
+    iov_add(l, gzip_vary_hdr, strlen(gzip_vary_hdr));
+  }
+  iov_add(l, conn_hdr, strlen(conn_hdr));
+  iov_add(l, endof_hdr, strlen(endof_hdr));
 }
 
-// URI 문자열을 파싱하여 호스트 이름, 포스, 경로를 분리하는 역할을 수행하는 함수
-void parse_uri(char *uri, char *hostname, char *path, int *port)
+// 원격 서버의 응답을 클라이언트에게 전달하면서 cachebuf에 모은다.
+// 응답 헤더는 이미 resp로 파싱되어 있어야 한다.
+// connfd가 -1이면(백그라운드 갱신) 전달하지 않고 모으기만 한다.
+// cachebuf에 모은 바이트 수를 반환한다. MAX_OBJECT_SIZE면 캐시하기에 너무 크다는 뜻이고,
+// 응답을 끝까지 받지 못했거나 클라이언트에게 쓰지 못했으면 -1을 반환한다.
+// head_only면 HEAD 요청에 대한 응답이라 헤더에 Content-Length가 있어도 본문이 없다.
+// gz가 있으면 클라이언트에게는 압축한 응답을 보내고, cachebuf에는 압축하지 않은 응답을,
+// gz->cachebuf에는 압축한 응답을 모은다.
+int relay_response(rio_t *server_rio, int connfd, http_req_t *resp, char *cachebuf, int head_only, gzip_ctx *gz)
 {
-  // HTTP 기본 포트 80번을 지정한다.
-  *port = 80;
-  // // 호스트 이름과 포트를 구분하는 구분자
-  // //를 찾아서 해당 위치를 포인터에 저장한다.
-  char *pos = strstr(uri, "//");
+  iov_list head, gzhead;
+  http_slice_t *te, *cl;
+  ssize_t len = -1;
+  char *end;
+  int sizebuf = 0, i, rc;
 
-  // NULL이 아니면 // 이후 문자열로 이동
-  // NULL이면 URL 전체를 가리키도록 설정한다.
-  pos = pos!=NULL? pos+2:uri;
+  // 응답 헤더를 cachebuf에 모으고 클라이언트에 보낸다.
+  // rio_writev가 iovec을 고쳐 쓰므로 먼저 모은다.
+  build_resp_header(&head, resp, 0);
+  for (i = 0; i < head.cnt; i++)
+    cache_append(cachebuf, &sizebuf, head.iov[i].iov_base, head.iov[i].iov_len);
+  if (gz != NULL)
+  {
+    build_resp_header(&gzhead, resp, 1);
+    for (i = 0; i < gzhead.cnt; i++)
+      cache_append(gz->cachebuf, &gz->sizebuf, gzhead.iov[i].iov_base, gzhead.iov[i].iov_len);
+    if (connfd >= 0 && rio_writev(connfd, gzhead.iov, gzhead.cnt) < 0)
+      return -1;
+  }
+  else if (connfd >= 0 && rio_writev(connfd, head.iov, head.cnt) < 0)
+    return -1;
+  // 헤더 조각을 다 썼으니 rio 버퍼에서 헤더를 소비하고 본문을 읽는다.
+  http_req_consume(server_rio, resp);
 
-  // : 로 호스트 이름과 포트를 구분하기 위한 구분자
-  // : 문자열을 찾아서 해당 위치를 포인터에 저장한다.
-  char *pos2 = strstr(pos, ":");
+  // 본문이 없는 응답
+  if (head_only || (resp->status >= 100 && resp->status < 200) || resp->status == 204 || resp->status == 304)
+    return sizebuf;
 
-  // pos2가 NULL이 아니면
-  // URI에 포트 번호가 지정되어 있어서 호스트 이름과 포트 번호를 추출한다.
-  if (pos2 != NULL) {
-    // pos2가 가리키는 위치에 NULL 삽입하여 호스트 이름을 종료
-    *pos2 = '\0';
-    // 호스트 이름을 읽어 변수에 저장한다.
-    sscanf(pos, "%s", hostname);
-    // 다음 문자열에서 포트 번호와 경로를 읽어 포트와 경로를 저장한다.
-    sscanf(pos2+1, "%d%s", port, path);
+  // 본문의 길이를 정하는 순서는 RFC 7230 3.3.3을 따른다.
+  // Transfer-Encoding의 마지막 코딩이 chunked면 청크를 풀고,
+  // chunked가 아니면 연결이 끊길 때까지 읽는다.
+  if ((te = http_req_header(resp, HDR_TRANSFER_ENCODING)) != NULL)
+  {
+    if (te->len >= 7 && !strncasecmp(te->ptr + te->len - 7, "chunked", 7))
+      rc = relay_chunked(server_rio, connfd, cachebuf, &sizebuf, 0, gz);
+    else
+      rc = relay_body(server_rio, connfd, -1, cachebuf, &sizebuf, gz);
   }
-  // 포트 번호가 지정x
-  // URI에는 호스트 이름만 지정된다.
-  // 호스트 이름과 경로를 추출한다.
-  else {
-    // /을 찾아서 pos2 포인터에 저장한다.
-    pos2 = strstr(pos, "/");
-    if (pos2 != NULL) {
-      // pos2 가리키는 위치에 NULL을 삽입하여 호스트 이름을 종료
-      *pos2 = '\0';
-      // 호스트 이름을 읽어 변수에 저장한다.
-      sscanf(pos, "%s", hostname);
-      // NULL을 /로 변경하여 원래 문자열을 복원
-      *pos2 = '/';
-      // 경로를 읽어서 저장한다.
-      sscanf(pos2, "%s", path);
-    } else {
-      scanf(pos, "%s", hostname);
+  else
+  {
+    // Content-Length가 있으면 그 길이만큼, 없으면 연결이 끊길 때까지 읽는다.
+    if ((cl = http_req_header(resp, HDR_CONTENT_LENGTH)) != NULL)
+    {
+      len = strtoll(cl->ptr, &end, 10);
+      if (end == cl->ptr || end != cl->ptr + cl->len || len < 0)
+        return -1;
     }
+    rc = relay_body(server_rio, connfd, len, cachebuf, &sizebuf, gz);
   }
-  return;
+  // 압축기에 남은 바이트와 gzip 트레일러를 내보낸다.
+  if (rc == 0 && gz != NULL)
+    rc = gzip_write(gz, NULL, 0, 1);
+  return rc < 0 ? -1 : sizebuf;
 }
 
-// 캐쉬를 초기화하는 함수
-// 캐시 데이터를 구조를 초기화하고
-// 캐시 내의 각 캐시 블록에 대한 초기 설정한다.
-void cache_init()
+// 본문 len 바이트를 전달한다. len이 -1이면 연결이 끊길 때까지 전달한다.
+// gz가 있으면 connfd 대신 압축 단계로 넘긴다.
+// 끝까지 전달했으면 0, 중간에 끊기거나 오류가 나면 -1을 반환한다.
+int relay_body(rio_t *rp, int connfd, ssize_t len, char *cachebuf, int *sizebuf, gzip_ctx *gz)
 {
-  // 구조체의 멤버를 0으로 저장하여
-  // 현재 캐시에 저장된 객체의 수를 나타낸다.
-  cache.cache_num = 0;
-  int i;
-  // 캐시 내의 각 캐시 블록을 초기화한다.
-  // 캐시 블록의 개수만큼 반복한다.
-  for (i=0; i<CACHE_OBJS_COUNT; i++) 
+  char buf[RELAY_BUFSIZE];
+  ssize_t n;
+  size_t want;
+
+  while (len != 0)
   {
-    // 각 캐시 블록의 LRU 멤버를 0으로 초기화한다.
-    cache.cacheobjs[i].LRU = 0;
-    // 캐시 블록이 비어 있는지 여부를 표시한다.
-    // 초기에는 모든 블록이 비어 있다.
-    cache.cacheobjs[i].isEmpty = 1;
-    // 캐시 블록에 대한 쓰기 작업을 동기화하기 위해 사용한다.
-    // 캐시 블록의 쓰기 뮤텍스를 초기화한다.
-    Sem_init(&cache.cacheobjs[i].wmutex, 0, 1);
-    // 읽기 작업을 동시에 수행할 시 클라이언트 수를 제어하기 위해 사용
-    // 캐시 블록의 쓰기 뮤텍스를 초기화한다.
-    Sem_init(&cache.cacheobjs[i].rdcntmutex, 0, 1);
-    // 현재 읽는 클라이언트의 수를 추적한다.
-    // 각 캐시 블록의 readcnt 멤버를 0으로 초기화한다.
-    cache.cacheobjs[i].readCnt = 0;
+    want = (len < 0 || len > RELAY_BUFSIZE) ? RELAY_BUFSIZE : len;
+    if ((n = relay_read(rp, buf, want)) < 0)
+      return -1;
+    // 연결이 끊겼다 - 길이를 모를 때만 정상적인 끝이다.
+    if (n == 0)
+      return len < 0 ? 0 : -1;
+    cache_append(cachebuf, sizebuf, buf, n);
+    if (gz != NULL)
+    {
+      if (gzip_write(gz, buf, n, 0) < 0)
+        return -1;
+    }
+    else if (connfd >= 0 && rio_writen(connfd, buf, n) < 0)
+      return -1;
+    if (len > 0)
+      len -= n;
   }
+  return 0;
 }
 
-// 캐시 블록에 대한 읽기 동작을 관리한다.
-// 읽기 작업을 동기화하고
-// 여러 클라이언트가 동시에 읽기를 수행 시 문제를 방지한다.
-void readerPre(int i) 
+// chunked 본문을 풀어서 전달한다.
+// 청크 크기 줄과 청크 끝의 CRLF, 마지막 트레일러는 rio 버퍼 안에서 바로 보고 버린다.
+// reframe이면(요청 본문을 원격 서버로 보낼 때) 청크 경계를 다시 붙여 chunked 그대로 보낸다.
+// 확장과 트레일러는 버리고 청크 크기만 다시 쓴다.
+int relay_chunked(rio_t *rp, int connfd, char *cachebuf, int *sizebuf, int reframe, gzip_ctx *gz)
 {
-  // 캐시 블록의 읽는 클라이언트 수를 조정하기 위해
-  // rdcntmutex를 잠근다.
-  P(&cache.cacheobjs[i].rdcntmutex);
-  // 현재 읽는 클라이언트의 수를 증가 시킨다.
-  cache.cacheobjs[i].readCnt++;
-  // 다른 클라이언트가 동시에 쓰기 작업을 시도x
-  // 만약 현재 읽는 클라이언트가 첫 번째 일 경우
-  // wmutex 뮤텍스를 잠근다.
-  if (cache.cacheobjs[i].readCnt == 1)
-    P(&cache.cacheobjs[i].wmutex);
-  // rdcntmutex 뮤텍스를 해제한다.
-  V(&cache.cacheobjs[i].rdcntmutex);
+  char *line, *end, sizeline[32];
+  ssize_t n, size;
+
+  while (1)
+  {
+    // 청크 크기 - 16진수 뒤에 ;확장이 올 수 있다.
+    // rio_getlineb가 돌려준 줄은 '\n'으로 끝나야 strtoll이 줄 밖을 읽지 않는다.
+    if ((n = rio_getlineb(rp, &line)) <= 0 || line[n - 1] != '\n' || !isxdigit((unsigned char)line[0]))
+      return -1;
+    size = strtoll(line, &end, 16);
+    if (size < 0 || (*end != ';' && *end != ' ' && *end != '\t' && *end != '\r' && *end != '\n'))
+      return -1;
+    if (size == 0)
+      break;
+    if (reframe)
+    {
+      n = snprintf(sizeline, sizeof(sizeline), "%zx\r\n", (size_t)size);
+      if (rio_writen(connfd, sizeline, n) < 0)
+        return -1;
+    }
+    if (relay_body(rp, connfd, size, cachebuf, sizebuf, gz) < 0)
+      return -1;
+    // 청크 데이터 뒤의 CRLF
+    if ((n = rio_getlineb(rp, &line)) <= 0 || (line[0] != '\r' && line[0] != '\n'))
+      return -1;
+    if (reframe && rio_writen(connfd, (void *)endof_hdr, strlen(endof_hdr)) < 0)
+      return -1;
+  }
+  // 트레일러 헤더는 빈 줄이 나올 때까지 버린다.
+  do {
+    if ((n = rio_getlineb(rp, &line)) <= 0)
+      return -1;
+  } while (!(n == 1 || (n == 2 && line[0] == '\r')));
+  // 마지막 청크와 빈 트레일러
+  if (reframe && rio_writen(connfd, "0\r\n\r\n", 5) < 0)
+    return -1;
+  return 0;
 }
-void readerAfter(int i) 
+
+// 본문을 읽는다. rio 버퍼에 남은 바이트가 있으면 그것부터 돌려주고,
+// 버퍼가 비었으면 rio 버퍼를 거치지 않고 buf로 n바이트까지 한 번에 읽는다.
+ssize_t relay_read(rio_t *rp, char *buf, size_t n)
 {
-  // 캐시 블록의 읽는 클라이언트 수를 조정하기 위해
-  // rdcntmutex를 잠근다.
-  P(&cache.cacheobjs[i].rdcntmutex);
-  // 현재 읽는 클라이언트의 수를 감소 시킨다.
-  cache.cacheobjs[i].readCnt--;
-  // 다른 클라이언트가 동시에 쓰기 작업을 시도x
-  // 만약 현재 읽는 클라이언트가 첫 번째 일 경우
-  // wmutex 뮤텍스를 잠근다.
-  if (cache.cacheobjs[i].readCnt == 0)
-    V(&cache.cacheobjs[i].wmutex);
-  // rdcntmutex 뮤텍스를 해제한다.
-  V(&cache.cacheobjs[i].rdcntmutex);
+  ssize_t rc;
+
+  if (rp->rio_cnt > 0)
+    return rio_readnb(rp, buf, n < rp->rio_cnt ? n : rp->rio_cnt);
+  while ((rc = read(rp->rio_fd, buf, n)) < 0 && errno == EINTR)
+    ;
+  return rc;
 }
 
-// 주어진 URL을 가진 객체가 캐시에 존재를 확인한다.
-int cache_find(char *url) 
+// 캐시에 저장할 응답을 cachebuf에 덧붙인다.
+// MAX_OBJECT_SIZE를 넘으면 sizebuf를 MAX_OBJECT_SIZE로 두어 캐시하지 않게 한다.
+// cachebuf가 NULL이면 캐시하지 않는 전달(요청 본문, 캐시하지 않는 메서드의 응답)이다.
+void cache_append(char *cachebuf, int *sizebuf, const void *data, size_t n)
 {
-  int i;
+  if (cachebuf == NULL)
+    return;
+  if (*sizebuf + n < MAX_OBJECT_SIZE)
+  {
+    memcpy(cachebuf + *sizebuf, data, n);
+    *sizebuf += n;
+  }
+  else
+    *sizebuf = MAX_OBJECT_SIZE;
+}
+
+// gzip 압축 단계를 시작한다. 압축한 응답은 connfd로 보내면서 cachebuf에 모은다.
+// zlib을 초기화하지 못하면 -1을 반환한다.
+int gzip_begin(gzip_ctx *gz, int connfd, char *cachebuf)
+{
+  memset(&gz->zs, 0, sizeof(gz->zs));
+  gz->connfd = connfd;
+  gz->cachebuf = cachebuf;
+  gz->sizebuf = 0;
+  // windowBits에 16을 더하면 zlib 대신 gzip 헤더와 트레일러를 붙인다.
+  if (deflateInit2(&gz->zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return -1;
+  return 0;
+}
+
+// data n바이트를 압축한다. 출력 버퍼가 찰 때마다 클라이언트에게 보내고 cachebuf에 모은다.
+// finish면 남은 바이트와 gzip 트레일러까지 내보낸다.
+// 클라이언트에게 쓰지 못하면 -1을 반환한다.
+int gzip_write(gzip_ctx *gz, const void *data, size_t n, int finish)
+{
+  char out[RELAY_BUFSIZE];
+  size_t have;
+
+  gz->zs.next_in = (Bytef *)data;
+  gz->zs.avail_in = n;
+  do {
+    gz->zs.next_out = (Bytef *)out;
+    gz->zs.avail_out = sizeof(out);
+    if (deflate(&gz->zs, finish ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR)
+      return -1;
+    have = sizeof(out) - gz->zs.avail_out;
+    cache_append(gz->cachebuf, &gz->sizebuf, out, have);
+    if (have > 0 && gz->connfd >= 0 && rio_writen(gz->connfd, out, have) < 0)
+      return -1;
+  } while (gz->zs.avail_out == 0);
+  return 0;
+}
+
+void gzip_end(gzip_ctx *gz)
+{
+  deflateEnd(&gz->zs);
+}
+
+// 압축해서 이득을 보는 응답인지 확인한다.
+// 이미 인코딩되지 않은 200 응답이고 Content-Type이 텍스트 계열이어야 한다.
+int gzip_type(http_req_t *resp)
+{
+  static const char *types[] = {
+    "text/", "application/javascript", "application/x-javascript", "application/json",
+    "application/xml", "application/xhtml+xml", "image/svg+xml", NULL
+  };
+  http_slice_t *ct;
+  size_t i, len;
+
+  if (resp->status != 200 || http_req_header(resp, HDR_CONTENT_ENCODING) != NULL
+      || (ct = http_req_header(resp, HDR_CONTENT_TYPE)) == NULL)
+    return 0;
+  for (i = 0; types[i] != NULL; i++)
+  {
+    len = strlen(types[i]);
+    if (ct->len >= len && !strncasecmp(ct->ptr, types[i], len))
+      return 1;
+  }
+  return 0;
+}
+
+// CONNECT로 port에 연결해도 되는지(CONNECT_PORTS에 있는지) 확인한다.
+int tunnel_port_allowed(int port)
+{
+  static const int ports[] = { CONNECT_PORTS };
+  size_t i;
+
+  for (i = 0; i < sizeof(ports) / sizeof(ports[0]); i++)
+    if (ports[i] == port)
+      return 1;
+  return 0;
+}
+
+// CONNECT 요청을 처리한다.
+// target("host:port")에 연결하고 200을 보낸 뒤, 어느 한쪽이 끊기거나
+// TUNNEL_IDLE_TIMEOUT 동안 아무 데이터도 오가지 않을 때까지 양방향으로 중계한다.
+// 두 방향을 스레드 둘로 나누지 않고 poll 하나로 돌린다.
+void tunnel(int connfd, rio_t *rio, char *target)
+{
+  char hostname[MAXLINE], *colon, *end;
+  int port, serverfd, i, nfds, rc, wait;
+  // dirs[0]: 클라이언트 → 서버, dirs[1]: 서버 → 클라이언트
+  tunnel_dir *dirs, *d;
+  struct pollfd pfds[2];
+  time_t start = time(NULL), last = start;
+  // 이번 반복 전까지 두 방향으로 보낸 바이트 수 - 유휴 판단용
+  long long moved;
+  static const char *established = "HTTP/1.0 200 Connection established\r\n\r\n";
+
+  // host:port, IPv6는 [addr]:port
+  if ((colon = strrchr(target, ':')) == NULL || colon == target
+      || (port = strtol(colon + 1, &end, 10)) <= 0 || port > 65535 || *end != '\0')
+  {
+    clienterror(connfd, target, "400", "Bad Request", "CONNECT target must be host:port");
+    return;
+  }
+  *colon = '\0';
+  if (target[0] == '[' && colon[-1] == ']')
+  {
+    colon[-1] = '\0';
+    target++;
+  }
+  snprintf(hostname, MAXLINE, "%s", target);
+
+  if (!tunnel_port_allowed(port))
+  {
+    clienterror(connfd, hostname, "403", "Forbidden", "Proxy doesn't tunnel to this port");
+    return;
+  }
+
+  // GET과 같이 실패한 호스트를 기억해 두고 다시 두드리지 않는다.
+  if ((rc = neg_host_find(hostname, port)) == 0 && (rc = serverfd = connect_endServer(hostname, port)) < 0)
+    neg_host_add(hostname, port, rc);
+  if (rc < 0)
+  {
+    clienterror(connfd, hostname, "502", "Bad Gateway", rc == -2 ? "Proxy couldn't resolve the end server"
+                                                               : "Proxy couldn't connect to the end server");
+    return;
+  }
+
+  if (rio_writen(connfd, (void *)established, strlen(established)) < 0)
+  {
+    Close(serverfd);
+    return;
+  }
+
+  dirs = Calloc(2, sizeof(tunnel_dir));
+  dirs[0].from = connfd;
+  dirs[0].to = serverfd;
+  dirs[1].from = serverfd;
+  dirs[1].to = connfd;
+  for (i = 0; i < 2; i++)
+    if (pipe(dirs[i].pipefd) < 0)
+      dirs[i].pipefd[0] = dirs[i].pipefd[1] = -1;
+
+  // 클라이언트가 CONNECT 헤더 바로 뒤에 보낸 데이터(TLS ClientHello 등)가
+  // rio 버퍼에 남아 있으면 먼저 보낸다.
+  if (rio->rio_cnt > 0)
+  {
+    if (rio_writen(serverfd, rio->rio_bufptr, rio->rio_cnt) < 0)
+      dirs[0].eof = dirs[1].eof = 1;
+    dirs[0].bytes += rio->rio_cnt;
+    rio->rio_cnt = 0;
+  }
+
+  // 쓸 수 있을 때만 쓰도록 두 소켓을 논블로킹으로 바꾼다.
+  fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL) | O_NONBLOCK);
+  fcntl(serverfd, F_SETFL, fcntl(serverfd, F_GETFL) | O_NONBLOCK);
+
+  while (!(dirs[0].eof && dirs[0].pending == 0 && dirs[1].eof && dirs[1].pending == 0))
+  {
+    // 방향마다 보낼 데이터가 남아 있으면 to의 쓰기를, 아니면 from의 읽기를 기다린다.
+    nfds = 0;
+    for (i = 0; i < 2; i++)
+    {
+      d = &dirs[i];
+      if (d->pending > 0)
+        pfds[nfds++] = (struct pollfd){ .fd = d->to, .events = POLLOUT };
+      else if (!d->eof)
+        pfds[nfds++] = (struct pollfd){ .fd = d->from, .events = POLLIN };
+    }
+    if ((wait = last + TUNNEL_IDLE_TIMEOUT - time(NULL)) <= 0)
+      break;
+    if ((rc = poll(pfds, nfds, wait * 1000)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    // 제한 시간 동안 양쪽 모두 조용했다.
+    if (rc == 0)
+      continue;
+
+    // 준비된 쪽만 기다린 것이 아니므로 두 방향을 모두 진행시켜 본다.
+    // 논블로킹이라 준비되지 않은 쪽은 EAGAIN으로 바로 돌아온다.
+    moved = dirs[0].bytes + dirs[1].bytes;
+    rc = 0;
+    for (i = 0; i < 2 && rc == 0; i++)
+    {
+      d = &dirs[i];
+      if (d->pending == 0 && !d->eof && (rc = tunnel_fill(d)) < 0)
+        break;
+      if (d->pending > 0 && (rc = tunnel_flush(d)) < 0)
+        break;
+      // 한쪽이 보내기를 끝내면 반대쪽에도 한 번만 알린다(반쯤 닫기).
+      if (d->eof && d->pending == 0 && !d->shut)
+      {
+        shutdown(d->to, SHUT_WR);
+        d->shut = 1;
+      }
+    }
+    if (rc < 0)
+      break;
+    // 실제로 데이터를 옮겼을 때만 유휴 시간을 다시 잰다.
+    // 깨어나기만 하고 옮긴 것이 없으면(오류 이벤트 등) 제한 시간은 그대로 흐른다.
+    if (dirs[0].bytes + dirs[1].bytes != moved)
+      last = time(NULL);
+  }
+
+  printf("CONNECT %s:%d closed: %lld bytes up, %lld bytes down, %ld s\n",
+         hostname, port, dirs[0].bytes, dirs[1].bytes, (long)(time(NULL) - start));
+  for (i = 0; i < 2; i++)
+    if (dirs[i].pipefd[0] >= 0)
+    {
+      Close(dirs[i].pipefd[0]);
+      Close(dirs[i].pipefd[1]);
+    }
+  Free(dirs);
+  Close(serverfd);
+}
+
+// splice(2) - _GNU_SOURCE 없이 쓰기 위해 시스템 호출을 직접 부른다.
+ssize_t tunnel_splice(int in, int out, size_t len)
+{
+  return syscall(SYS_splice, in, NULL, out, NULL, len, TUNNEL_SPLICE_MOVE | TUNNEL_SPLICE_NONBLOCK);
+}
+
+// from에서 읽을 수 있는 만큼 파이프(또는 buf)로 옮긴다.
+// 읽을 것이 없으면 0, EOF면 eof를 세우고 0, 오류면 -1을 반환한다.
+int tunnel_fill(tunnel_dir *d)
+{
+  ssize_t n;
+
+  if (d->pipefd[1] >= 0)
+  {
+    n = tunnel_splice(d->from, d->pipefd[1], TUNNEL_CHUNK);
+    // 이 소켓에서 splice를 쓸 수 없으면 read/write로 바꾼다.
+    if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+    {
+      Close(d->pipefd[0]);
+      Close(d->pipefd[1]);
+      d->pipefd[0] = d->pipefd[1] = -1;
+      return tunnel_fill(d);
+    }
+  }
+  else
+  {
+    n = read(d->from, d->buf, TUNNEL_BUFSIZE);
+    d->off = 0;
+  }
+
+  if (n < 0)
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+  if (n == 0)
+    d->eof = 1;
+  d->pending = n;
+  return 0;
+}
+
+// 파이프(또는 buf)에 남은 바이트를 to로 쓸 수 있는 만큼 쓴다.
+int tunnel_flush(tunnel_dir *d)
+{
+  ssize_t n;
+
+  if (d->pipefd[0] >= 0)
+    n = tunnel_splice(d->pipefd[0], d->to, d->pending);
+  else
+    n = write(d->to, d->buf + d->off, d->pending);
+  if (n < 0)
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+  d->pending -= n;
+  d->off += n;
+  d->bytes += n;
+  return 0;
+}
+
+// 프록시가 직접 만든 오류 응답을 클라이언트에게 보내는 함수
+// tiny의 clienterror와 같은 형태로 응답 라인, 헤더, HTML 본문을 전송한다.
+// 클라이언트가 끊어서 쓰지 못하면 프로세스를 끝내지 않고 -1을 반환한다.
+int clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg)
+{
+  // HTTP 응답 헤더, HTML 응답 본문 문자열
+  char buf[MAXLINE], body[MAXBUF];
+
+  // 응답 본문
+  snprintf(body, MAXBUF, "<html><title>Proxy Error</title>"
+           "<body bgcolor=""ffffff"">\r\n"
+           "%s: %s\r\n"
+           "<p>%s: %.512s\r\n"
+           "<hr><em>The Proxy server</em>\r\n",
+           errnum, shortmsg, longmsg, cause);
+
+  // 응답 헤더
+  snprintf(buf, MAXLINE, "HTTP/1.0 %s %s\r\n"
+           "Content-type: text/html\r\n"
+           "Connection: close\r\n"
+           "Content-length: %d\r\n\r\n",
+           errnum, shortmsg, (int)strlen(body));
+
+  // HTTP 응답 헤더와 본문은 클라이언트에게 전송한다.
+  if (rio_writen(fd, buf, strlen(buf)) < 0 || rio_writen(fd, body, strlen(body)) < 0)
+    return -1;
+  return 0;
+}
+
+// iovec 목록에 조각 하나를 덧붙인다.
+void iov_add(iov_list *l, const void *base, size_t len)
+{
+  if (len == 0)
+    return;
+  l->iov[l->cnt].iov_base = (void *)base;
+  l->iov[l->cnt].iov_len = len;
+  l->cnt++;
+}
+
+// HTTP 헤더를 구성하는 함수
+// 호스트 이름, 경로 및 클라이언트로부터 받은 헤더 정보를 사용해서
+// 완전한 HTTP 요청을 iovec 목록으로 만든다.
+// 헤더를 복사하지 않으므로 전달하는 헤더의 길이에 MAXLINE 같은 제한이 없다.
+// 요청 본문이 chunked면 Transfer-Encoding을 다시 붙이고 HTTP/1.1로 보낸다.
+void build_http_header(iov_list *ureq, char *method, char *hostname, char *path, http_req_t *req) 
+{
+  http_header_t *h;
+  http_slice_t *host;
+  int i, chunked = req != NULL && http_req_header(req, HDR_TRANSFER_ENCODING) != NULL;
+
+  ureq->cnt = 0;
+
+  // 요청 라인 - method " " path " HTTP/1.0\r\n"
+  iov_add(ureq, method, strlen(method));
+  iov_add(ureq, requestline_sep, strlen(requestline_sep));
+  iov_add(ureq, path, strlen(path));
+  if (chunked)
+    iov_add(ureq, requestline_version11, strlen(requestline_version11));
+  else
+    iov_add(ureq, requestline_version, strlen(requestline_version));
+
+  // 호스트 헤더 - 클라이언트가 보낸 첫 Host 값, 없으면 URI의 호스트 이름
+  // 백그라운드 갱신처럼 클라이언트가 없으면(req가 NULL) 기본 헤더만 만든다.
+  iov_add(ureq, host_hdr_key, strlen(host_hdr_key));
+  if (req != NULL && (host = http_req_header(req, HDR_HOST)) != NULL)
+    iov_add(ureq, host->ptr, host->len);
+  else
+    iov_add(ureq, hostname, strlen(hostname));
+  iov_add(ureq, endof_hdr, strlen(endof_hdr));
+
+  // Connection, Proxy-Connection, User-Agent는 프록시가 정한 값으로 보낸다.
+  iov_add(ureq, conn_hdr, strlen(conn_hdr));
+  iov_add(ureq, prox_hdr, strlen(prox_hdr));
+  iov_add(ureq, user_agent_hdr, strlen(user_agent_hdr));
+  if (chunked)
+    iov_add(ureq, chunked_hdr, strlen(chunked_hdr));
+
+  // 나머지 헤더는 파서가 돌려준 이름과 값 조각을 그대로 가리킨다.
+  // 홉 단위 헤더(RFC 7230 6.1)와 Connection 헤더에 이름이 적힌 헤더는 넘기지 않는다.
+  // Expect는 프록시가 직접 답하고, chunked와 함께 온 Content-Length는 무시되는 값이므로 뺀다.
+  // GET은 캐시에 압축하지 않은 응답을 저장하고 압축은 프록시가 하므로 Accept-Encoding을 넘기지 않는다.
+  for (i = 0; req != NULL && i < req->nheaders; i++)
+  {
+    h = &req->headers[i];
+    if (h->id == HDR_HOST || h->id == HDR_USER_AGENT || h->id == HDR_EXPECT || HDR_IS_HOP(h->id))
+      continue;
+    if (h->id == HDR_ACCEPT_ENCODING && !strcmp(method, "GET"))
+      continue;
+    if (chunked && h->id == HDR_CONTENT_LENGTH)
+      continue;
+    if (req->hdr_index[HDR_CONNECTION] != -1 && http_conn_listed(req, &h->name))
+      continue;
+    iov_add(ureq, h->name.ptr, h->name.len);
+    iov_add(ureq, hdr_sep, strlen(hdr_sep));
+    iov_add(ureq, h->value.ptr, h->value.len);
+    iov_add(ureq, endof_hdr, strlen(endof_hdr));
+  }
+  // 헤더의 끝
+  iov_add(ureq, endof_hdr, strlen(endof_hdr));
+}
+
+// 요청 본문의 길이를 정하는 방식을 돌려준다(RFC 7230 3.3.3).
+// Content-Length면 len에 길이를 넣는다.
+// Transfer-Encoding의 마지막 코딩이 chunked가 아니거나 Content-Length 값이 잘못됐거나
+// 서로 다르면 본문의 끝을 알 수 없으므로 -1을 반환한다 - 그대로 넘기면 요청 스머글링이 된다.
+int request_body(http_req_t *req, ssize_t *len)
+{
+  http_slice_t *te;
+  http_header_t *h;
+  ssize_t n;
+  char *end;
+  int i, found = 0;
+
+  if ((te = http_req_header(req, HDR_TRANSFER_ENCODING)) != NULL)
+  {
+    if (te->len >= 7 && !strncasecmp(te->ptr + te->len - 7, "chunked", 7))
+      return BODY_CHUNKED;
+    return -1;
+  }
+  for (i = 0; i < req->nheaders; i++)
+  {
+    h = &req->headers[i];
+    if (h->id != HDR_CONTENT_LENGTH)
+      continue;
+    if (h->value.len == 0 || !isdigit((unsigned char)h->value.ptr[0]))
+      return -1;
+    n = strtoll(h->value.ptr, &end, 10);
+    if (end != h->value.ptr + h->value.len || n < 0 || (found && n != *len))
+      return -1;
+    *len = n;
+    found = 1;
+  }
+  return found ? BODY_LENGTH : BODY_NONE;
+}
+
+// 요청 본문을 클라이언트의 rio 버퍼에 남은 바이트부터 원격 서버로 흘려 보낸다.
+// 전체를 메모리에 모으지 않고 RELAY_BUFSIZE 단위로 읽는 대로 쓴다.
+// 끝까지 보냈으면 0, 클라이언트나 원격 서버 쪽에서 끊기면 -1을 반환한다.
+int forward_body(rio_t *rp, int serverfd, int body, ssize_t len)
+{
+  int sizebuf = 0;
+
+  if (body == BODY_LENGTH)
+    return relay_body(rp, serverfd, len, NULL, &sizebuf, NULL);
+  if (body == BODY_CHUNKED)
+    return relay_chunked(rp, serverfd, NULL, &sizebuf, 1, NULL);
+  return 0;
+}
+
+// 원격 서버에 연결하기 위한 함수
+// 호스트 이름, 포트 번호를 사용하여
+// 원격 서버에 연결하고 연결된 소켓 파일 디스크립터를 반환한다.
+int connect_endServer(char *hostname, int port)
+{
+  // 문자열 형태로 포트 번호를 저장하기 위한 버퍼
+  char portStr[100];
+  // 호스트와 연결 시 포트 번호를 문자열 형태로 사용한다.
+  // 정수형 포트 번호를 문자열로 변환한다.
+  sprintf(portStr, "%d", port);
+  // 변환된 포트 번호를 사용해서 호스트에 연견한다.
+  // 호스트와 연결된 소켓 파일 디스크립터를 반환한다.
+  // 연결 실패 시 프로세스를 종료하지 않도록 open_clientfd를 직접 호출한다.
+  // DNS 조회 실패 시 -2, 연결 실패 시 -1을 반환한다.
+  return open_clientfd(hostname, portStr);
+}
+
+// URI 문자열을 파싱하여 호스트 이름, 포스, 경로를 분리하는 역할을 수행하는 함수
+void parse_uri(char *uri, char *hostname, char *path, int *port)
+{
+  // HTTP 기본 포트 80번을 지정한다.
+  *port = 80;
+  // // 호스트 이름과 포트를 구분하는 구분자
+  // //를 찾아서 해당 위치를 포인터에 저장한다.
+  char *pos = strstr(uri, "//");
+
+  // NULL이 아니면 // 이후 문자열로 이동
+  // NULL이면 URL 전체를 가리키도록 설정한다.
+  pos = pos!=NULL? pos+2:uri;
+
+  // : 로 호스트 이름과 포트를 구분하기 위한 구분자
+  // : 문자열을 찾아서 해당 위치를 포인터에 저장한다.
+  char *pos2 = strstr(pos, ":");
+
+  // pos2가 NULL이 아니면
+  // URI에 포트 번호가 지정되어 있어서 호스트 이름과 포트 번호를 추출한다.
+  if (pos2 != NULL) {
+    // pos2가 가리키는 위치에 NULL 삽입하여 호스트 이름을 종료
+    *pos2 = '\0';
+    // 호스트 이름을 읽어 변수에 저장한다.
+    sscanf(pos, "%s", hostname);
+    // 다음 문자열에서 포트 번호와 경로를 읽어 포트와 경로를 저장한다.
+    sscanf(pos2+1, "%d%s", port, path);
+  }
+  // 포트 번호가 지정x
+  // URI에는 호스트 이름만 지정된다.
+  // 호스트 이름과 경로를 추출한다.
+  else {
+    // /을 찾아서 pos2 포인터에 저장한다.
+    pos2 = strstr(pos, "/");
+    if (pos2 != NULL) {
+      // pos2 가리키는 위치에 NULL을 삽입하여 호스트 이름을 종료
+      *pos2 = '\0';
+      // 호스트 이름을 읽어 변수에 저장한다.
+      sscanf(pos, "%s", hostname);
+      // NULL을 /로 변경하여 원래 문자열을 복원
+      *pos2 = '/';
+      // 경로를 읽어서 저장한다.
+      sscanf(pos2, "%s", path);
+    } else {
+      scanf(pos, "%s", hostname);
+    }
+  }
+  return;
+}
+
+// 캐쉬를 초기화하는 함수
+// 캐시 데이터를 구조를 초기화하고
+// 캐시 내의 각 캐시 블록에 대한 초기 설정한다.
+// shared가 1이면 fork한 작업 프로세스들이 함께 쓰도록 POSIX 공유 메모리에 캐시를 만든다.
+void cache_init(int shared)
+{
+  int i, fd;
+  char name[64];
+
+  cache_pid = getpid();
+  if (shared)
+  {
+    // 이름은 만들자마자 지워서 다른 프로세스가 열 수 없게 하고
+    // 매핑은 fork로만 물려준다.
+    sprintf(name, "/proxy-cache-%d", (int)cache_pid);
+    if ((fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600)) < 0)
+      unix_error("shm_open error");
+    shm_unlink(name);
+    if (ftruncate(fd, sizeof(Cache)) < 0)
+      unix_error("ftruncate error");
+    cache = Mmap(NULL, sizeof(Cache), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Close(fd);
+  }
+  else
+    cache = Calloc(1, sizeof(Cache));
+
+  // 구조체의 멤버를 0으로 저장하여
+  // 현재 캐시에 저장된 객체의 수를 나타낸다.
+  cache->cache_num = 0;
+  // 캐시 내의 각 캐시 블록을 초기화한다.
+  // 캐시 블록의 개수만큼 반복한다.
+  for (i=0; i<CACHE_OBJS_COUNT; i++) 
+  {
+    // 각 캐시 블록의 LRU 멤버를 0으로 초기화한다.
+    cache->cacheobjs[i].LRU = 0;
+    // 캐시 블록이 비어 있는지 여부를 표시한다.
+    // 초기에는 모든 블록이 비어 있다.
+    cache->cacheobjs[i].isEmpty = 1;
+    cache->cacheobjs[i].obj_len = 0;
+    cache->cacheobjs[i].hdr_len = 0;
+    cache->cacheobjs[i].body = -1;
+    cache->cacheobjs[i].status = 0;
+    cache->cacheobjs[i].expires = 0;
+    cache->cacheobjs[i].swr = 0;
+    cache->cacheobjs[i].sie = 0;
+    cache->cacheobjs[i].tags[0] = '\0';
+    // 캐시 블록에 대한 읽기, 쓰기 작업을 동기화하기 위해 사용한다.
+    shared_mutex_init(&cache->cacheobjs[i].lock);
+    // 현재 읽는 클라이언트의 수를 추적한다.
+    // 각 캐시 블록의 readcnt 멤버를 0으로 초기화한다.
+    cache->cacheobjs[i].readCnt = 0;
+    memset(cache->cacheobjs[i].reader_cnt, 0, sizeof(cache->cacheobjs[i].reader_cnt));
+  }
+
+  // 본문 풀을 비우고 풀 뮤텍스를 초기화한다.
+  for (i = 0; i < CACHE_BODY_COUNT; i++)
+    cache->bodies[i].refcnt = 0;
+  cache->dedup_hits = 0;
+  shared_mutex_init(&cache->body_mutex);
+
+  // 사용량을 0으로 두고 사용량 뮤텍스와 회수 스레드용 세마포어를 초기화한다.
+  cache->cache_bytes = 0;
+  cache->body_num = 0;
+  shared_mutex_init(&cache->usage_mutex);
+  Sem_init(&cache->reclaim_wake, 1, 0);
+  cache->reclaim_pending = 0;
+
+  // URL 색인을 비우고 색인 뮤텍스를 초기화한다.
+  cache->url_index_cnt = 0;
+  shared_mutex_init(&cache->index_mutex);
+
+  // 실패한 호스트 테이블을 비우고 테이블 뮤텍스를 초기화한다.
+  for (i=0; i<NEG_HOST_COUNT; i++)
+    cache->neg_hosts[i].expires = 0;
+  shared_mutex_init(&cache->neg_mutex);
+
+  // 갱신 작업 테이블을 비우고 테이블 뮤텍스와 세마포어를 초기화한다.
+  for (i = 0; i < REFRESH_QUEUE_SIZE; i++)
+    cache->refresh.jobs[i].state = 0;
+  shared_mutex_init(&cache->refresh.mutex);
+  Sem_init(&cache->refresh.items, 1, 0);
+
+  // 쓰기 구간을 열어 두고 구간 뮤텍스를 초기화한다.
+  cache->write_active = 0;
+  cache->write_closed = 0;
+  memset(cache->write_cnt, 0, sizeof(cache->write_cnt));
+  shared_mutex_init(&cache->write_mutex);
+}
+
+// 프로세스 간에 공유할 수 있는 robust 뮤텍스를 초기화한다.
+// 잡고 있던 프로세스가 죽으면 다음에 잡는 쪽이 EOWNERDEAD를 받고 상태를 복구할 수 있다.
+void shared_mutex_init(pthread_mutex_t *m)
+{
+  pthread_mutexattr_t attr;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(m, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+// 뮤텍스를 잡는다.
+// 이전에 잡고 있던 프로세스가 놓지 않고 죽었으면 뮤텍스를 다시 쓸 수 있게 만들고 1을 반환한다.
+// 호출한 쪽은 보호하던 데이터가 중간 상태일 수 있음을 고려해야 한다.
+int shared_lock(pthread_mutex_t *m)
+{
+  int rc = pthread_mutex_lock(m);
+
+  if (rc == EOWNERDEAD)
+  {
+    pthread_mutex_consistent(m);
+    return 1;
+  }
+  if (rc != 0)
+    posix_error(rc, "pthread_mutex_lock error");
+  return 0;
+}
+
+void shared_unlock(pthread_mutex_t *m)
+{
+  pthread_mutex_unlock(m);
+}
+
+// 프로세스별 기록(pids, cnts)에서 pid 프로세스의 수를 delta만큼 바꾼다.
+// 블록의 읽기 기록과 쓰기 구간 기록에 쓰며, 기록을 보호하는 뮤텍스를 잡은 상태에서 호출해야 한다.
+void pid_track(pid_t *pids, int *cnts, pid_t pid, int delta)
+{
+  int i, empty = -1;
+
+  for (i = 0; i < READER_PIDS; i++)
+  {
+    if (cnts[i] > 0 && pids[i] == pid)
+    {
+      cnts[i] += delta;
+      return;
+    }
+    if (cnts[i] == 0 && empty == -1)
+      empty = i;
+  }
+  if (empty != -1 && delta > 0)
+  {
+    pids[empty] = pid;
+    cnts[empty] = delta;
+  }
+}
+
+// 프로세스별 기록에서 pid 프로세스의 항목을 지우고 그 수를 반환한다.
+int pid_take(pid_t *pids, int *cnts, pid_t pid)
+{
+  int i, cnt;
+
+  for (i = 0; i < READER_PIDS; i++)
+  {
+    if (cnts[i] > 0 && pids[i] == pid)
+    {
+      cnt = cnts[i];
+      cnts[i] = 0;
+      return cnt;
+    }
+  }
+  return 0;
+}
+
+// 블록의 뮤텍스를 잡는다.
+// 쓰던 프로세스가 도중에 죽었으면 블록 내용이 깨졌을 수 있으므로 비운다.
+// 색인과 사용량은 부모 프로세스의 cache_recover가 다시 맞춘다.
+void block_lock(int i)
+{
+  if (shared_lock(&cache->cacheobjs[i].lock))
+    cache->cacheobjs[i].isEmpty = 1;
+}
+
+// 캐시 블록에 대한 읽기 동작을 관리한다.
+// 읽기 작업을 동기화하고
+// 여러 클라이언트가 동시에 읽기를 수행 시 문제를 방지한다.
+// 읽는 동안 블록의 뮤텍스를 잡고 있지 않으므로 느린 클라이언트가 다른 읽기를 막지 않는다.
+void readerPre(int i) 
+{
+  // 쓰는 중이면 쓰기가 끝날 때까지 기다린다.
+  block_lock(i);
+  // 현재 읽는 클라이언트의 수를 증가 시킨다.
+  // 쓰는 쪽은 readCnt가 0이 될 때까지 기다린다.
+  cache->cacheobjs[i].readCnt++;
+  pid_track(cache->cacheobjs[i].reader_pid, cache->cacheobjs[i].reader_cnt, cache_pid, 1);
+  shared_unlock(&cache->cacheobjs[i].lock);
+}
+void readerAfter(int i) 
+{
+  block_lock(i);
+  // 현재 읽는 클라이언트의 수를 감소 시킨다.
+  cache->cacheobjs[i].readCnt--;
+  pid_track(cache->cacheobjs[i].reader_pid, cache->cacheobjs[i].reader_cnt, cache_pid, -1);
+  shared_unlock(&cache->cacheobjs[i].lock);
+}
+
+// 죽은 작업 프로세스 pid가 남긴 캐시 상태를 되돌린다. 부모 프로세스가 호출한다.
+// 그 프로세스가 읽던 블록의 readCnt에서 그 몫만 빼고, 잡고 있던 뮤텍스는 robust 뮤텍스가 풀어 준다.
+// 쓰기 구간 안에서 죽었으면 색인, 본문 참조 수, 사용량이 중간 상태일 수 있으므로
+// 다른 프로세스의 쓰기를 모두 멈춘 뒤에 블록 상태로부터 다시 만든다.
+void cache_recover(pid_t pid)
+{
+  int i, dirty;
+  struct timespec ts = {0, 1000000};
+
+  for (i = 0; i < CACHE_OBJS_COUNT; i++)
+  {
+    cache_block *cb = &cache->cacheobjs[i];
+    block_lock(i);
+    cb->readCnt -= pid_take(cb->reader_pid, cb->reader_cnt, pid);
+    shared_unlock(&cb->lock);
+  }
+
+  // 쓰기 구간을 닫고 죽은 프로세스의 몫을 뺀 뒤 진행 중인 쓰기가 끝나기를 기다린다.
+  // 새 쓰기는 블록의 잠금을 잡기 전에 멈추므로 기다리는 동안 교착 상태가 생기지 않는다.
+  shared_lock(&cache->write_mutex);
+  cache->write_closed = 1;
+  dirty = pid_take(cache->write_pid, cache->write_cnt, pid);
+  cache->write_active -= dirty;
+  while (cache->write_active > 0)
+  {
+    shared_unlock(&cache->write_mutex);
+    nanosleep(&ts, NULL);
+    shared_lock(&cache->write_mutex);
+  }
+  shared_unlock(&cache->write_mutex);
+
+  if (dirty)
+    cache_rebuild();
+
+  shared_lock(&cache->write_mutex);
+  cache->write_closed = 0;
+  shared_unlock(&cache->write_mutex);
+
+  // 회수 스레드를 깨웠다는 표시를 남기고 죽었을 수 있으므로 다시 깨울 수 있게 한다.
+  shared_lock(&cache->usage_mutex);
+  cache->reclaim_pending = 0;
+  shared_unlock(&cache->usage_mutex);
+
+  // 실패한 호스트 테이블을 쓰다가 죽었으면 neg_lock이 테이블을 비운다.
+  neg_lock();
+  shared_unlock(&cache->neg_mutex);
+
+  // 그 프로세스가 진행하던 갱신 작업을 비워서 같은 URL을 다시 예약할 수 있게 한다.
+  shared_lock(&cache->refresh.mutex);
+  for (i = 0; i < REFRESH_QUEUE_SIZE; i++)
+    if (cache->refresh.jobs[i].state == 2 && cache->refresh.jobs[i].owner == pid)
+      cache->refresh.jobs[i].state = 0;
+  shared_unlock(&cache->refresh.mutex);
+}
+
+// 블록 상태로부터 URL 색인, 본문의 참조 수, 사용량을 다시 만든다.
+// 쓰기 구간이 닫혀 있고 구간 안에 아무도 없을 때만 호출한다. 그동안 값을 바꾸는 쪽이 없으므로
+// 센 값으로 덮어써도 다른 프로세스의 변경을 잃지 않는다.
+// 색인은 색인 뮤텍스를 잡은 채 한 번에 다시 만들어서 읽는 쪽이 빈 색인을 보지 않게 한다.
+void cache_rebuild()
+{
+  int i, bytes = 0, objs = 0, bodies = 0;
+  int refs[CACHE_BODY_COUNT] = {0};
+
+  shared_lock(&cache->index_mutex);
+  cache->url_index_cnt = 0;
+  for (i = 0; i < CACHE_OBJS_COUNT; i++)
+  {
+    // 죽은 프로세스가 쓰던 블록은 block_lock이 비운다.
+    block_lock(i);
+    if (!cache->cacheobjs[i].isEmpty)
+    {
+      index_insert_locked(i, cache->cacheobjs[i].cache_url);
+      bytes += cache->cacheobjs[i].hdr_len;
+      objs++;
+      if (cache->cacheobjs[i].body != -1)
+        refs[cache->cacheobjs[i].body]++;
+    }
+    shared_unlock(&cache->cacheobjs[i].lock);
+  }
+  shared_unlock(&cache->index_mutex);
+
+  // 비워진 블록이 들고 있던 참조와 블록에 붙기 전에 죽은 참조는 여기서 풀린다.
+  shared_lock(&cache->body_mutex);
+  for (i = 0; i < CACHE_BODY_COUNT; i++)
+  {
+    cache->bodies[i].refcnt = refs[i];
+    if (refs[i] > 0)
+    {
+      bytes += cache->bodies[i].len;
+      bodies++;
+    }
+  }
+  shared_unlock(&cache->body_mutex);
+
+  shared_lock(&cache->usage_mutex);
+  cache->cache_bytes = bytes;
+  cache->cache_num = objs;
+  cache->body_num = bodies;
+  shared_unlock(&cache->usage_mutex);
+}
+
+// 캐시 블록의 신선도를 확인한다.
+// 신선하면 CACHE_FRESH, stale-while-revalidate 기간 안이면 CACHE_STALE,
+// stale-if-error 기간 안이면 CACHE_STALE_ERROR, 더 이상 쓸 수 없으면 -1을 반환한다.
+int cache_state(cache_block *cb, time_t now)
+{
+  if (cb->expires == 0 || now < cb->expires)
+    return CACHE_FRESH;
+  if (now < cb->expires + cb->swr)
+    return CACHE_STALE;
+  if (now < cb->expires + cb->sie)
+    return CACHE_STALE_ERROR;
+  return -1;
+}
+
+// 캐시 블록을 클라이언트에게 전송한다.
+// cache_find와 전송 사이에 블록이 다른 URI로 교체되었을 수 있으므로
+// 읽기 잠금을 잡은 뒤 URI를 다시 확인하고, 다르면 0을 반환한다.
+// 보냈으면 1, 클라이언트에게 쓰지 못했으면 -1을 반환한다. 어느 쪽이든 원격 서버로 가지 않는다.
+// req가 HEAD면 헤더만, 조건부 요청의 조건이 맞으면 304만 보내고 본문은 건드리지 않는다.
+// req가 NULL이면 저장된 응답 전체를 보낸다.
+int cache_send(int fd, int i, char *url, http_req_t *req)
+{
+  struct iovec iov[2];
+  int rc = 1;
+
+  // 캐시 블록에 대한 읽기 작업 시작
+  readerPre(i);
+  cache_block *cb = &cache->cacheobjs[i];
+  if (cb->isEmpty == 1 || strcmp(url, cb->cache_url) != 0)
+  {
+    readerAfter(i);
+    return 0;
+  }
+  // 네거티브 항목이면 원격 서버에 가지 않고 프록시가 직접 오류 응답을 만든다.
+  if (cb->status >= 400)
+  {
+    char errnum[16];
+    sprintf(errnum, "%d", cb->status);
+    if (clienterror(fd, url, errnum, cb->cache_head, "Proxy remembered an error from the end server") < 0)
+      rc = -1;
+  }
+  else
+  {
+    switch (cache_send_mode(cb, req))
+    {
+    case CACHE_SEND_NOT_MODIFIED:
+      if (rio_writen(fd, cb->nm_head, cb->nm_len) < 0)
+        rc = -1;
+      break;
+    case CACHE_SEND_HEAD:
+      if (rio_writen(fd, cb->cache_head, cb->hdr_len) < 0)
+        rc = -1;
+      break;
+    default:
+      // 클라이언트에게 캐시된 데이터를 전송한다.
+      // 블록의 헤더와 본문 풀의 본문을 writev 한 번으로 보낸다.
+      iov[0].iov_base = cb->cache_head;
+      iov[0].iov_len = cb->hdr_len;
+      if (cb->body != -1)
+      {
+        iov[1].iov_base = cache->bodies[cb->body].data;
+        iov[1].iov_len = cache->bodies[cb->body].len;
+      }
+      if (rio_writev(fd, iov, cb->body != -1 ? 2 : 1) < 0)
+        rc = -1;
+    }
+  }
+  // 캐시 블록에 대한 읽기 작업을 완료하고 동기화를 해제 또는 정리 작업
+  readerAfter(i);
+  return rc;
+}
+
+// 압축하지 않은 캐시 블록을 gzip으로 압축해서 클라이언트에게 보내고
+// gz_key에 gzip 변형으로 캐시한다. 압축 비용은 객체마다 한 번만 든다.
+// 압축할 수 없는 블록이거나 HEAD, 304로 답할 조건부 요청이면 아무것도 보내지 않고 0을 반환한다.
+// 보냈으면 1, 클라이언트에게 쓰지 못했으면 캐시하지 않고 -1을 반환한다.
+int cache_send_gzip(int fd, int i, char *url, http_req_t *req, char *gz_key)
+{
+  cache_block *cb = &cache->cacheobjs[i];
+  http_req_t resp;
+  iov_list head;
+  gzip_ctx gz;
+  char *gzbuf;
+  int j, rc;
+
+  readerPre(i);
+  if (cb->isEmpty == 1 || strcmp(url, cb->cache_url) != 0 || !cb->gzip_ok
+      || cache_send_mode(cb, req) != CACHE_SEND_FULL)
+  {
+    readerAfter(i);
+    return 0;
+  }
+  // 저장된 헤더를 다시 파싱해서 gzip 응답 헤더를 만든다.
+  http_resp_init(&resp);
+  gzbuf = Malloc(MAX_OBJECT_SIZE);
+  if (cb->body == -1 || http_parse_response(&resp, cb->cache_head, cb->hdr_len) != HTTP_PARSE_DONE
+      || gzip_begin(&gz, fd, gzbuf) < 0)
+  {
+    readerAfter(i);
+    Free(gzbuf);
+    return 0;
+  }
+  build_resp_header(&head, &resp, 1);
+  for (j = 0; j < head.cnt; j++)
+    cache_append(gzbuf, &gz.sizebuf, head.iov[j].iov_base, head.iov[j].iov_len);
+  if ((rc = rio_writev(fd, head.iov, head.cnt)) >= 0)
+    rc = gzip_write(&gz, cache->bodies[cb->body].data, cache->bodies[cb->body].len, 1);
+  readerAfter(i);
+  gzip_end(&gz);
+
+  if (rc >= 0 && gz.sizebuf < MAX_OBJECT_SIZE)
+  {
+    gzbuf[gz.sizebuf] = '\0';
+    cache_uri(gz_key, gzbuf, gz.sizebuf);
+  }
+  Free(gzbuf);
+  return rc < 0 ? -1 : 1;
+}
+
+// 캐시 블록의 어느 부분을 보낼지 정한다(CACHE_SEND_*).
+// 블록의 읽기 잠금을 잡은 상태에서 호출해야 한다.
+// 조건부 요청은 RFC 7232 6의 순서대로 If-None-Match가 있으면 그것만 보고,
+// 없을 때 If-Modified-Since를 본다. 200 응답만 304로 바꿔 답한다.
+int cache_send_mode(cache_block *cb, http_req_t *req)
+{
+  http_slice_t *inm, *ims;
+  time_t since;
+
+  if (req == NULL)
+    return CACHE_SEND_FULL;
+  if (cb->status == 200 && cb->nm_len > 0)
+  {
+    if ((inm = http_req_header(req, HDR_IF_NONE_MATCH)) != NULL)
+    {
+      if (http_etag_match(inm, cb->etag))
+        return CACHE_SEND_NOT_MODIFIED;
+    }
+    else if ((ims = http_req_header(req, HDR_IF_MODIFIED_SINCE)) != NULL
+             && cb->last_modified != 0 && (since = http_date(ims->ptr, ims->len)) != 0
+             && cb->last_modified <= since)
+      return CACHE_SEND_NOT_MODIFIED;
+  }
+  return http_slice_eq(&req->method, "HEAD") ? CACHE_SEND_HEAD : CACHE_SEND_FULL;
+}
+
+// 주어진 URL을 가진 객체가 캐시에 존재를 확인한다.
+// 찾은 블록이 신선한지, 만료되었지만 제공할 수 있는지를 state에 저장한다.
+int cache_find(char *url, int *state) 
+{
+  int i;
+  time_t now = time(NULL);
   // 캐시 블록의 개수에 대한 루프를 수행한다.
   for (i = 0; i < CACHE_OBJS_COUNT; i++) 
   {
-    // 현재 캐시 블록에 대한 읽기 작업을 시작
-    // 다른 클라이언트가 동시에 캐시를 읽을 수 있도록 한다.
+    // 현재 캐시 블록에 대한 읽기 작업을 시작
+    // 다른 클라이언트가 동시에 캐시를 읽을 수 있도록 한다.
+    readerPre(i);
+    // 현재 캐시 블록이 비어x
+    // 멤버가 0이면 캐시 블록이 비어x
+    // 만료된 뒤 stale-while-revalidate, stale-if-error 기간도 지난 블록은 없는 것으로 취급한다.
+    if (cache->cacheobjs[i].isEmpty == 0 && strcmp(url, cache->cacheobjs[i].cache_url) == 0
+        && (*state = cache_state(&cache->cacheobjs[i], now)) != -1)
+    {
+      // 다른 클라이언트가 캐시를 읽을 수 있는 상태로 만든다.
+      // 현재 캐시 블록에 대한 읽기 작업을 완료
+      readerAfter(i);
+      // URL이 캐시에 존재하는 경우 해당 캐시 블록의 인덱스를 반환
+      return i;
+    }
+    // 다른 클라이언트가 캐시를 읽을 수 있는 상태로 만든다.
+    readerAfter(i);
+  }
+  // URL이 캐시에 존재x - -1반환
+  return -1;
+}
+
+// LRU 알고리즘을 기반으로 캐시 객체를 삭제한다.
+// 삭제할 캐시를 후보를 선택한다.
+int cache_eviction() 
+{
+  // 초기에는 큰 값으로 설정하여 첫 번째 빈 블록을 선택하는 것을 보장한다.
+  // 현재까지 확인한 캐시 블록 중 LRU 값
+  int min = LRU_MAGIC_NUMBER;
+  // 선택한 후보 블록의 인덱스
+  int minindex = 0;
+  int i;
+  time_t now = time(NULL);
+  // 모든 캐시 블록에 대한 루프
+  for (i=0; i<CACHE_OBJS_COUNT; i++) 
+  {
+    // 현재 캐시 블록에 대한 읽기 작업
+    readerPre(i);
+    // 현재 캐시 블록이 비어 있거나 더 이상 제공할 수 없을 만큼 만료된 경우
+    // 맴버가 1이면 캐시 블록이 비어 있다.
+    if (cache->cacheobjs[i].isEmpty == 1 || cache_state(&cache->cacheobjs[i], now) == -1) 
+    {
+      // 현재 블록의 인덱스로 설정
+      minindex = i;
+      // 읽기 작업을 완료하고 루프 종료
+      readerAfter(i);
+      break;
+    }
+    // 현재 캐시 블록의 LRU 값이 현재까지 확인한 최소 LRU 값보다 작은 경우
+    if (cache->cacheobjs[i].LRU < min) 
+    {
+      // 현재 블록의 인덱스로 설정
+      minindex = i;
+      // min을 현재 블록의 LRU값으로 변경한다.
+      min = cache->cacheobjs[i]. LRU;
+      // 읽기 작업을 완료한다.
+      readerAfter(i);
+      continue;
+    }
+    // 읽기 작업을 완료한다.
+    readerAfter(i);
+  }
+  // 삭제할 블록을 선택한다.
+  // LRU 알고리즘으로 선정된 후보 블록의 인덱스를 반환한다.
+  return minindex;
+}
+
+// 다중 스레드 환경에서 캐시 블록에 대한 쓰기 작업을 동기화한다.
+// 캐시 블록에 대한 쓰기 작업을 시작 전에
+// 해당 캐시 블록의 뮤텍스를 잠그고 읽는 클라이언트가 모두 끝나기를 기다린다.
+// 다른 스레드, 프로세스와의 동시적인 쓰기 작업 충돌을 방지한다.
+// 쓰기 구간에 들어간다. 호출한 쪽은 색인과 사용량까지 반영한 뒤 write_leave로 나온다.
+void writePre(int i) 
+{
+  struct timespec ts = {0, 1000000};
+
+  write_enter();
+  // 현재 쓰기 작업을 시작한 스레드가 뮤텍스를 소유
+  // 다른 쓰레드는 쓰기 작업이 완료 시까지 대기한다.
+  block_lock(i);
+  // 읽는 중인 클라이언트가 있으면 뮤텍스를 잠시 놓고 기다린다.
+  // 읽는 쪽이 다른 프로세스일 수 있어서 조건 변수 대신 짧게 잠들며 확인한다.
+  // 기다리는 동안은 쓰기 구간에서도 나와 있어야 느린 클라이언트가 cache_recover를 막지 않는다.
+  while (cache->cacheobjs[i].readCnt > 0)
+  {
+    shared_unlock(&cache->cacheobjs[i].lock);
+    write_leave();
+    nanosleep(&ts, NULL);
+    write_enter();
+    block_lock(i);
+  }
+}
+
+// 쓰기 구간에 들어간다. cache_recover가 구간을 닫아 두었으면 열릴 때까지 기다린다.
+void write_enter()
+{
+  struct timespec ts = {0, 1000000};
+
+  shared_lock(&cache->write_mutex);
+  while (cache->write_closed)
+  {
+    shared_unlock(&cache->write_mutex);
+    nanosleep(&ts, NULL);
+    shared_lock(&cache->write_mutex);
+  }
+  cache->write_active++;
+  pid_track(cache->write_pid, cache->write_cnt, cache_pid, 1);
+  shared_unlock(&cache->write_mutex);
+}
+
+void write_leave()
+{
+  shared_lock(&cache->write_mutex);
+  cache->write_active--;
+  pid_track(cache->write_pid, cache->write_cnt, cache_pid, -1);
+  shared_unlock(&cache->write_mutex);
+}
+
+// 다중 스레드 환경에서 캐시 블록에 대한 쓰기 작업을 동기화한다.
+// 캐시 블록에 대한 쓰기 작업이 완료 시 
+// 해당 캐시 블록의 뮤텍스를 해제한다.
+// 쓰기 작업의 충돌을 방지하고 뮤텍스를 다른 스레드에게 양보한다.
+void writeAfter(int i) 
+{
+  // 캐시 블록의 뮤텍스를 해제한다.
+  // 쓰기 작업이 완료된 스레드가 뮤텍스를 해제하고
+  // 다른 쓰레드는 쓰기 작업을 수행한다.
+  shared_unlock(&cache->cacheobjs[i].lock);
+}
+
+// 캐시 블록 내의 객체의 LRU 값을 업데이트한다.
+// 새로운 객체가 캐시에 저장되거나 읽혔을 때 LRU 값을 조정한다.
+void cache_LRU(int index) 
+{
+  int i;
+  // 모든 캐시 블록에 대한 루프 수행
+  for (i = 0; i < CACHE_OBJS_COUNT; i++) 
+  {
+    // 현재 반복이 인덱스와 일치하는 경우 다음 반복으로 넘어간다.
+    // 현재 객체의 LRU값을 업데이트x
+    if (i == index) 
+    {
+      continue;
+    }
+    // 현재 캐시 블록에 대한 쓰기 작업
+    writePre(i);
+    // 현재 블록이 비어있지 않는 경우
+    // 해당 캐시 블록의 LRU 값을 감소한다.
+    // LRU 값이 낮아지면서 해당 객체가 더 최근에 사용되었을 표시한다.
+    if (cache->cacheobjs[i].isEmpty == 0) 
+    {
+      cache->cacheobjs[i].LRU--;
+    }
+    // 현재 캐시 블록에 대한 쓰기 작업을 완료한다.
+    writeAfter(i);
+    write_leave();
+  }
+}
+
+// 원격 서버 응답의 Cache-Control, Expires 헤더에서 얻은 정보
+typedef struct
+{
+  // no-store, no-cache, private 중 하나라도 있으면 1
+  int no_store;
+  // 원격 서버가 지정한 신선도 수명(초) - 지정하지 않았으면 -1
+  int max_age;
+  // stale-while-revalidate 값(초) - 지정하지 않았으면 0
+  int swr;
+  // stale-if-error 값(초) - 지정하지 않았으면 -1
+  int sie;
+  // must-revalidate, proxy-revalidate가 있으면 1 - 만료된 객체를 제공하지 않는다.
+  int must_revalidate;
+  // Surrogate-Key, Cache-Tag 헤더의 태그들 - " tag1 tag2 " 형태
+  char tags[CACHE_TAGS_LEN];
+}cache_ctrl;
+
+// 응답 헤더를 훑어서 캐시 관련 지시자를 읽는다.
+// resp는 '\0'으로 끝나는 응답 전체이며 빈 줄에서 헤더 읽기를 멈춘다.
+void parse_cache_ctrl(char *resp, cache_ctrl *cc)
+{
+  char *line, *next, *p;
+  int smaxage = -1, maxage = -1, has_expires = 0;
+  time_t expires = 0, date = 0;
+  struct tm tm;
+
+  cc->no_store = 0;
+  cc->max_age = -1;
+  cc->swr = 0;
+  cc->sie = -1;
+  cc->must_revalidate = 0;
+  strcpy(cc->tags, " ");
+
+  // 상태 라인을 건너뛴다.
+  if ((line = strstr(resp, "\r\n")) == NULL)
+    return;
+  line += 2;
+
+  // 빈 줄(헤더의 끝)을 만날 때까지 한 줄씩 검사한다.
+  while (*line != '\0' && strncmp(line, "\r\n", 2) != 0)
+  {
+    if ((next = strstr(line, "\r\n")) == NULL)
+      break;
+
+    if (!strncasecmp(line, "Cache-Control:", 14))
+    {
+      // 지시자는 쉼표로 구분되며 줄 안에서만 찾는다.
+      for (p = line + 14; p < next; p++)
+      {
+        if (!strncasecmp(p, "no-store", 8) || !strncasecmp(p, "no-cache", 8) || !strncasecmp(p, "private", 7))
+          cc->no_store = 1;
+        else if (!strncasecmp(p, "s-maxage=", 9))
+          smaxage = atoi(p + 9);
+        else if (!strncasecmp(p, "max-age=", 8))
+          maxage = atoi(p + 8);
+        else if (!strncasecmp(p, "stale-while-revalidate=", 23))
+          cc->swr = atoi(p + 23);
+        else if (!strncasecmp(p, "stale-if-error=", 15))
+          cc->sie = atoi(p + 15);
+        else if (!strncasecmp(p, "must-revalidate", 15) || !strncasecmp(p, "proxy-revalidate", 16))
+          cc->must_revalidate = 1;
+      }
+    }
+    else if (!strncasecmp(line, "Expires:", 8))
+    {
+      // 날짜 형식이 잘못된 Expires는 이미 만료된 것으로 본다(RFC 7234 5.3).
+      memset(&tm, 0, sizeof(tm));
+      has_expires = 1;
+      if (strptime(line + 8 + strspn(line + 8, " \t"), "%a, %d %b %Y %H:%M:%S GMT", &tm))
+        expires = timegm(&tm);
+    }
+    else if (!strncasecmp(line, "Surrogate-Key:", 14) || !strncasecmp(line, "Cache-Tag:", 10))
+    {
+      // Surrogate-Key는 공백, Cache-Tag는 쉼표로 태그를 구분한다.
+      // 두 형식 모두 공백 하나로 구분된 목록으로 바꿔서 덧붙인다.
+      int len = strlen(cc->tags);
+      for (p = strchr(line, ':') + 1; p < next; p++)
+      {
+        if (*p == ' ' || *p == '\t' || *p == ',')
+        {
+          if (cc->tags[len - 1] != ' ' && len < CACHE_TAGS_LEN - 1)
+            cc->tags[len++] = ' ';
+        }
+        else if (len < CACHE_TAGS_LEN - 2)
+          cc->tags[len++] = *p;
+      }
+      if (cc->tags[len - 1] != ' ')
+        cc->tags[len++] = ' ';
+      cc->tags[len] = '\0';
+    }
+    else if (!strncasecmp(line, "Date:", 5))
+    {
+      memset(&tm, 0, sizeof(tm));
+      if (strptime(line + 5 + strspn(line + 5, " \t"), "%a, %d %b %Y %H:%M:%S GMT", &tm))
+        date = timegm(&tm);
+    }
+    line = next + 2;
+  }
+
+  // 공유 캐시이므로 s-maxage, max-age, Expires 순서로 우선한다.
+  if (smaxage >= 0)
+    cc->max_age = smaxage;
+  else if (maxage >= 0)
+    cc->max_age = maxage;
+  else if (has_expires)
+  {
+    // Expires는 원격 서버의 Date 기준으로 계산해야 시계 차이의 영향을 받지 않는다.
+    if (date == 0)
+      date = time(NULL);
+    cc->max_age = expires > date ? (int)(expires - date) : 0;
+  }
+}
+
+// 200 응답의 헤더로 304 Not Modified 응답 헤더를 만든다.
+// RFC 7232 4.1에 따라 200이었으면 보냈을 Cache-Control, Date, ETag, Expires, Vary만 남긴다.
+// 만든 바이트 수를 반환하고, size에 들어가지 않으면 0을 반환한다.
+int build_not_modified(http_req_t *resp, char *dst, int size)
+{
+  http_header_t *h;
+  int i, n;
+
+  n = snprintf(dst, size, "%.*s 304 Not Modified\r\n", (int)resp->version.len, resp->version.ptr);
+  for (i = 0; i < resp->nheaders && n < size; i++)
+  {
+    h = &resp->headers[i];
+    if (h->id != HDR_CACHE_CONTROL && h->id != HDR_DATE && h->id != HDR_ETAG
+        && h->id != HDR_EXPIRES && h->id != HDR_VARY)
+      continue;
+    n += snprintf(dst + n, size - n, "%.*s: %.*s\r\n", (int)h->name.len, h->name.ptr,
+                  (int)h->value.len, h->value.ptr);
+  }
+  if (n < size)
+    n += snprintf(dst + n, size - n, "%s\r\n", conn_hdr);
+  return n < size ? n : 0;
+}
+
+// 네거티브 캐시 대상이 되는 원격 서버의 오류 상태 코드인지 확인한다.
+int is_negative_status(int status)
+{
+  return status == 404 || status == 410 || (status >= 500 && status <= 504);
+}
+
+// URI에 대한 캐시 업데이트 작업
+// buf는 원격 서버의 응답 전체, len은 응답의 바이트 수
+void cache_uri(char *uri, char *buf, int len) 
+{
+  int i, status = 0, ttl = 0, swr = 0, sie = 0, hdr_len = len;
+  cache_ctrl cc;
+  char reason[MAXLINE];
+  // 상태 라인과 헤더 - 헤더와 본문의 경계, 검증자, 304 응답 헤더를 만드는 데 쓴다.
+  http_req_t resp;
+  http_slice_t *v;
+  char etag[CACHE_ETAG_LEN], nm_head[CACHE_NM_LEN];
+  time_t last_modified = 0;
+  int nm_len = 0, gzip_ok = 0;
+  // 본문의 해시 - 본문 풀에서 같은 내용을 찾는 데 쓴다.
+  unsigned long long hash = 0;
+  int body_len, body, new_bytes = 0, tries;
+
+  // 상태 라인에서 상태 코드와 사유 문구를 읽는다.
+  reason[0] = '\0';
+  if (sscanf(buf, "HTTP/%*d.%*d %d %[^\r\n]", &status, reason) < 1)
+    return;
+  // 클라이언트의 조건부 요청이나 Range 요청에 대한 응답은 객체 전체가 아니다.
+  if (status == 304 || status == 206)
+    return;
+
+  // 캐시 관련 헤더를 읽는다.
+  parse_cache_ctrl(buf, &cc);
+
+  if (is_negative_status(status))
+  {
+    // 원격 서버가 저장을 금지하면 기억하지 않는다.
+    if (cc.no_store)
+      return;
+    // 원격 서버가 수명을 정했으면 따르되 네거티브 항목은 짧게 유지한다.
+    ttl = cc.max_age >= 0 ? cc.max_age : NEG_CACHE_TTL;
+    if (ttl > NEG_CACHE_TTL_MAX)
+      ttl = NEG_CACHE_TTL_MAX;
+    if (ttl == 0)
+      return;
+    if (reason[0] == '\0')
+      strcpy(reason, "Error");
+    // 네거티브 항목은 응답 본문 대신 사유 문구만 저장한다.
+    buf = reason;
+    len = hdr_len = strlen(reason) + 1;
+  }
+  else
+  {
+    // 원격 서버가 저장을 금지하면 기존 블록도 지운다.
+    if (cc.no_store)
+    {
+      if ((i = cache_slot(uri)) != -1)
+        cache_remove(i, uri);
+      return;
+    }
+    // 헤더와 본문의 경계를 기억하고 검증자와 304 응답 헤더를 미리 만들어 둔다.
+    // 요청마다 저장된 헤더를 다시 파싱하지 않기 위해서다.
+    etag[0] = '\0';
+    http_resp_init(&resp);
+    if (http_parse_response(&resp, buf, len) == HTTP_PARSE_DONE)
+    {
+      hdr_len = resp.head_len;
+      if ((v = http_req_header(&resp, HDR_ETAG)) != NULL && http_slice_copy(v, etag, CACHE_ETAG_LEN) < 0)
+        etag[0] = '\0';
+      if ((v = http_req_header(&resp, HDR_LAST_MODIFIED)) != NULL)
+        last_modified = http_date(v->ptr, v->len);
+      nm_len = build_not_modified(&resp, nm_head, CACHE_NM_LEN);
+      gzip_ok = gzip_type(&resp);
+    }
+    // 원격 서버가 신선도 수명을 정한 응답만 만료 시각을 가진다.
+    // 수명이 없는 응답은 이전처럼 교체될 때까지 유지한다.
+    if (cc.max_age >= 0)
+    {
+      // 수명이 0이어도 만료된 상태로 저장해서 stale 기간 동안 쓸 수 있게 한다.
+      ttl = cc.max_age;
+      if (!cc.must_revalidate)
+      {
+        swr = cc.swr > STALE_MAX ? STALE_MAX : cc.swr;
+        sie = cc.sie < 0 ? STALE_IF_ERROR_DEFAULT : (cc.sie > STALE_MAX ? STALE_MAX : cc.sie);
+      }
+      // 만료 후 쓸 수 있는 기간이 전혀 없으면 저장할 이유가 없다.
+      if (ttl == 0 && swr == 0 && sie == 0)
+        return;
+    }
+  }
+
+  // 헤더는 블록에, 본문은 본문 풀에 저장한다.
+  if (hdr_len > CACHE_HEAD_SIZE)
+    return;
+  body_len = len - hdr_len;
+  // 본문 풀에 같은 내용도 빈 칸도 없으면 회수 스레드를 기다리지 않고 LRU 블록을 비운다.
+  // 함께 쓰는 본문은 마지막 블록이 비워져야 풀리므로 여러 블록을 비울 수 있다.
+  if (body_len > 0)
+  {
+    hash = body_hash(buf + hdr_len, body_len);
+    for (tries = 0; tries < CACHE_OBJS_COUNT && !body_available(hash, buf + hdr_len, body_len); tries++)
+      if (!cache_evict_lru())
+        break;
+  }
+
+  // 같은 URI가 이미 있으면(만료된 항목 포함) 그 블록을 다시 쓰고
+  // 없으면 회수 스레드가 비워 둔 블록을 쓴다.
+  // 회수 스레드가 따라오지 못해 빈 블록이 없을 때만 요청 스레드에서 직접
+  // 캐시에서 삭제할 후보 블록의 인덱스를 가져온다.
+  if ((i = cache_slot(uri)) == -1 && (i = cache_free_slot()) == -1)
+    i = cache_eviction();
+  
+  // 선택된 캐시 블록에 대한 쓰기 작업 수행
+  // 다른 스레드가 동시에 캐시 블록을 수정x
+  writePre(i);
+  // 사용량 계산을 위해 블록의 이전 상태를 기억하고 이전 본문의 참조를 놓는다.
+  // 블록의 쓰기 잠금을 잡고 있으므로 이전 본문을 읽는 중인 요청은 없다.
+  int old_used = !cache->cacheobjs[i].isEmpty;
+  int old_len = 0, old_body = 0;
+  if (old_used)
+  {
+    old_len = cache->cacheobjs[i].hdr_len;
+    if (cache->cacheobjs[i].body != -1 && (old_body = body_release(cache->cacheobjs[i].body)) > 0)
+      old_len += old_body;
+  }
+  cache->cacheobjs[i].body = -1;
+
+  // 본문 풀에서 같은 내용의 본문을 찾아 함께 쓰거나 빈 칸에 새로 저장한다.
+  // 그사이 다른 요청이 빈 칸을 가져갔으면 저장하지 못하고 블록을 비운다.
+  body = -1;
+  if (body_len > 0 && (body = body_acquire(hash, buf + hdr_len, body_len, &new_bytes)) < 0)
+  {
+    cache->cacheobjs[i].isEmpty = 1;
+    writeAfter(i);
+    if (old_used)
+      index_del(i);
+    cache_usage(-old_len, -old_used, -(old_body > 0));
+    write_leave();
+    return;
+  }
+
+  // 캐시에 데이터 저장 - 선택된 캐시 블록에 헤더를 복사하고 본문을 가리킨다.
+  memcpy(cache->cacheobjs[i].cache_head, buf, hdr_len);
+  cache->cacheobjs[i].body = body;
+  cache->cacheobjs[i].obj_len = len;
+  cache->cacheobjs[i].status = status;
+  cache->cacheobjs[i].hdr_len = hdr_len;
+  // 검증자와 304 응답 헤더 - 네거티브 항목에는 없다.
+  if (is_negative_status(status))
+  {
+    cache->cacheobjs[i].etag[0] = '\0';
+    cache->cacheobjs[i].last_modified = 0;
+    cache->cacheobjs[i].nm_len = 0;
+    cache->cacheobjs[i].gzip_ok = 0;
+  }
+  else
+  {
+    strcpy(cache->cacheobjs[i].etag, etag);
+    cache->cacheobjs[i].last_modified = last_modified;
+    memcpy(cache->cacheobjs[i].nm_head, nm_head, nm_len);
+    cache->cacheobjs[i].nm_len = nm_len;
+    cache->cacheobjs[i].gzip_ok = gzip_ok;
+  }
+  // 만료 시각과 만료 후 제공할 수 있는 기간을 저장한다.
+  // 수명이 없는 응답은 0(만료되지 않음), 수명이 0인 응답은 지금 바로 만료된다.
+  cache->cacheobjs[i].expires = (ttl > 0 || cc.max_age == 0) ? time(NULL) + ttl : 0;
+  cache->cacheobjs[i].swr = swr;
+  cache->cacheobjs[i].sie = sie;
+  // PURGE에서 태그로 찾을 수 있도록 태그 목록을 저장한다.
+  strcpy(cache->cacheobjs[i].tags, cc.tags);
+  // 캐시에 URI 식별 - 선택된 캐시 블록에 URI를 복사
+  strcpy(cache->cacheobjs[i].cache_url, uri);
+  // 선택된 캐시 블록이 비어 있지 않는 상태 표시
+  cache->cacheobjs[i].isEmpty = 0;
+  // 객체가 최근에 사용됨을 표시한다.
+  // 선택된 캐시 블록의 LRU 값을 LRU 매직 넘버로 설정
+  cache->cacheobjs[i].LRU = LRU_MAGIC_NUMBER;
+  // 쓰기 작업을 완료
+  // 다른 쓰레드가 캐시 블록에 대한 작업을 수행 가능 상태
+  writeAfter(i);
+  // URL 색인에 블록의 새 URL을 반영한다.
+  index_set(i, uri);
+  // 사용량을 반영하고 상위 워터마크를 넘었으면 회수 스레드를 깨운다.
+  cache_usage(hdr_len + new_bytes - old_len, 1 - old_used, (new_bytes > 0) - (old_body > 0));
+  write_leave();
+  // 현재 객체가 가장 최근에 사용됨을 표시 - LRU값 업데이트
+  // 다른 블록의 쓰기 잠금을 잡으므로 이 블록의 잠금을 놓고 쓰기 구간에서 나온 뒤에 호출해야
+  // 두 스레드가 서로의 블록을 기다리는 교착 상태가 생기지 않는다.
+  cache_LRU(i);
+}
+
+// 캐시 사용량을 바꾸고 상위 워터마크를 넘으면 회수 스레드를 깨운다.
+// bytes는 바뀐 바이트 수, objs는 바뀐 블록 수, bodies는 바뀐 본문 수
+void cache_usage(int bytes, int objs, int bodies)
+{
+  int wake = 0;
+
+  shared_lock(&cache->usage_mutex);
+  cache->cache_bytes += bytes;
+  cache->cache_num += objs;
+  cache->body_num += bodies;
+  if (!cache->reclaim_pending
+      && (cache->cache_bytes > CACHE_HIGH_WATERMARK || cache->cache_num > CACHE_HIGH_SLOTS
+          || cache->body_num > CACHE_HIGH_BODIES))
+  {
+    cache->reclaim_pending = 1;
+    wake = 1;
+  }
+  shared_unlock(&cache->usage_mutex);
+  if (wake)
+    V(&cache->reclaim_wake);
+}
+
+// 사용량이 하위 워터마크보다 큰지 확인한다.
+int cache_above_low()
+{
+  int above;
+
+  shared_lock(&cache->usage_mutex);
+  above = cache->cache_bytes > CACHE_LOW_WATERMARK || cache->cache_num > CACHE_LOW_SLOTS
+          || cache->body_num > CACHE_LOW_BODIES;
+  shared_unlock(&cache->usage_mutex);
+  return above;
+}
+
+// 비어 있는 캐시 블록을 찾는다. 없으면 -1을 반환한다.
+int cache_free_slot()
+{
+  int i, empty;
+
+  for (i = 0; i < CACHE_OBJS_COUNT; i++)
+  {
+    readerPre(i);
+    empty = cache->cacheobjs[i].isEmpty;
+    readerAfter(i);
+    if (empty)
+      return i;
+  }
+  return -1;
+}
+
+// 회수 스레드를 시작한다.
+void reclaim_init()
+{
+  pthread_t tid;
+  Pthread_create(&tid, NULL, reclaim_thread, NULL);
+}
+
+// 회수 스레드 - 상위 워터마크를 넘었다는 신호를 받거나
+// RECLAIM_INTERVAL초마다 깨어나서 캐시를 정리한다.
+void *reclaim_thread(void *vargp)
+{
+  struct timespec ts;
+
+  Pthread_detach(pthread_self());
+  while (1)
+  {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += RECLAIM_INTERVAL;
+    while (sem_timedwait(&cache->reclaim_wake, &ts) < 0 && errno == EINTR)
+      ;
+    cache_reclaim();
+  }
+  return NULL;
+}
+
+// 더 이상 제공할 수 없을 만큼 만료된 블록을 비우고
+// 사용량이 하위 워터마크 아래로 내려갈 때까지 LRU 값이 가장 작은 블록을 비운다.
+void cache_reclaim()
+{
+  int i, dead, tries;
+  char url[MAXLINE];
+  time_t now = time(NULL);
+
+  // 만료된 블록 정리
+  for (i = 0; i < CACHE_OBJS_COUNT; i++)
+  {
+    readerPre(i);
+    dead = cache->cacheobjs[i].isEmpty == 0 && cache_state(&cache->cacheobjs[i], now) == -1;
+    if (dead)
+      strcpy(url, cache->cacheobjs[i].cache_url);
+    readerAfter(i);
+    if (dead)
+      cache_remove(i, url);
+  }
+
+  // 하위 워터마크까지 LRU 블록 정리
+  // 다른 스레드가 동시에 블록을 바꾸면 비우기가 실패할 수 있으므로 시도 횟수를 제한한다.
+  for (tries = 0; tries < CACHE_OBJS_COUNT && cache_above_low(); tries++)
+    if (!cache_evict_lru())
+      break;
+
+  // 다시 상위 워터마크를 넘으면 깨울 수 있도록 플래그를 내린다.
+  shared_lock(&cache->usage_mutex);
+  cache->reclaim_pending = 0;
+  shared_unlock(&cache->usage_mutex);
+}
+
+// LRU 값이 가장 작은 블록 하나를 비운다. 비울 블록이 없으면 0을 반환한다.
+int cache_evict_lru()
+{
+  int i, victim = -1, min = LRU_MAGIC_NUMBER + 1;
+  char url[MAXLINE];
+
+  for (i = 0; i < CACHE_OBJS_COUNT; i++)
+  {
+    readerPre(i);
+    if (cache->cacheobjs[i].isEmpty == 0 && cache->cacheobjs[i].LRU < min)
+    {
+      victim = i;
+      min = cache->cacheobjs[i].LRU;
+      strcpy(url, cache->cacheobjs[i].cache_url);
+    }
+    readerAfter(i);
+  }
+  if (victim == -1)
+    return 0;
+  cache_remove(victim, url);
+  return 1;
+}
+
+// 본문 내용의 64비트 해시
+// 8바이트씩 섞어서 바이트마다 곱하는 FNV보다 빠르다. 충돌은 내용 비교로 걸러낸다.
+unsigned long long body_hash(const char *p, size_t n)
+{
+  unsigned long long h = 0x9e3779b97f4a7c15ULL ^ n, w;
+
+  for (; n >= 8; p += 8, n -= 8)
+  {
+    memcpy(&w, p, 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+  }
+  for (; n > 0; p++, n--)
+    h = (h ^ (unsigned char)*p) * 0x100000001b3ULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// 본문 풀에서 내용이 같은 본문을 찾는다. 본문 풀 뮤텍스를 잡은 상태에서 호출해야 한다.
+int body_find(unsigned long long hash, const char *data, int len)
+{
+  int i;
+  cache_body *b;
+
+  for (i = 0; i < CACHE_BODY_COUNT; i++)
+  {
+    b = &cache->bodies[i];
+    if (b->refcnt > 0 && b->hash == hash && b->len == len && !memcmp(b->data, data, len))
+      return i;
+  }
+  return -1;
+}
+
+// 본문을 저장할 수 있는지(같은 내용이 있거나 빈 칸이 있는지) 확인한다.
+int body_available(unsigned long long hash, const char *data, int len)
+{
+  int i, ok;
+
+  shared_lock(&cache->body_mutex);
+  ok = body_find(hash, data, len) != -1;
+  for (i = 0; !ok && i < CACHE_BODY_COUNT; i++)
+    ok = cache->bodies[i].refcnt == 0;
+  shared_unlock(&cache->body_mutex);
+  return ok;
+}
+
+// 본문의 참조를 얻는다. 같은 내용이 있으면 그 칸의 참조 수를 올리고(new_bytes 0),
+// 없으면 빈 칸에 복사한다(new_bytes는 본문 길이). 빈 칸이 없으면 -1을 반환한다.
+int body_acquire(unsigned long long hash, const char *data, int len, int *new_bytes)
+{
+  int i;
+  cache_body *b;
+
+  *new_bytes = 0;
+  shared_lock(&cache->body_mutex);
+  if ((i = body_find(hash, data, len)) != -1)
+  {
+    cache->bodies[i].refcnt++;
+    cache->dedup_hits++;
+    shared_unlock(&cache->body_mutex);
+    return i;
+  }
+  for (i = 0; i < CACHE_BODY_COUNT; i++)
+  {
+    b = &cache->bodies[i];
+    if (b->refcnt != 0)
+      continue;
+    // 내용을 다 쓴 뒤에 참조 수를 올려야 다른 요청이 반쯤 쓴 본문을 찾지 않는다.
+    memcpy(b->data, data, len);
+    b->len = len;
+    b->hash = hash;
+    b->refcnt = 1;
+    *new_bytes = len;
+    break;
+  }
+  shared_unlock(&cache->body_mutex);
+  return i < CACHE_BODY_COUNT ? i : -1;
+}
+
+// 본문의 참조를 놓는다. 마지막 참조였으면 풀린 바이트 수, 아니면 0을 반환한다.
+int body_release(int slot)
+{
+  int freed = 0;
+
+  shared_lock(&cache->body_mutex);
+  if (--cache->bodies[slot].refcnt == 0)
+    freed = cache->bodies[slot].len;
+  shared_unlock(&cache->body_mutex);
+  return freed;
+}
+
+// 캐시 통계를 buf에 text/plain 형식으로 쓴다.
+// 블록들이 가리키는 본문 길이의 합과 본문 풀에 실제로 저장된 길이의 차이가 중복 제거로 아낀 바이트다.
+void cache_stats(char *buf, size_t size)
+{
+  long long logical = 0, stored = 0, hits;
+  int i, objs = 0, bodies = 0, bytes;
+
+  for (i = 0; i < CACHE_OBJS_COUNT; i++)
+  {
     readerPre(i);
-    // 현재 캐시 블록이 비어x
-    // 멤버가 0이면 캐시 블록이 비어x
-    if (cache.cacheobjs[i].isEmpty == 0 && strcmp(url, cache.cacheobjs[i].cache_url) == 0)
+    if (cache->cacheobjs[i].isEmpty == 0)
     {
-      // 다른 클라이언트가 캐시를 읽을 수 있는 상태로 만든다.
-      // 현재 캐시 블록에 대한 읽기 작업을 완료
-      readerAfter(i);
-      // URL이 캐시에 존재하는 경우 해당 캐시 블록의 인덱스를 반환
-      return i;
+      objs++;
+      if (cache->cacheobjs[i].body != -1)
+        logical += cache->bodies[cache->cacheobjs[i].body].len;
     }
-    // 다른 클라이언트가 캐시를 읽을 수 있는 상태로 만든다.
     readerAfter(i);
   }
-  // URL이 캐시에 존재x - -1반환
-  return -1;
+  shared_lock(&cache->body_mutex);
+  for (i = 0; i < CACHE_BODY_COUNT; i++)
+    if (cache->bodies[i].refcnt > 0)
+    {
+      stored += cache->bodies[i].len;
+      bodies++;
+    }
+  hits = cache->dedup_hits;
+  shared_unlock(&cache->body_mutex);
+  shared_lock(&cache->usage_mutex);
+  bytes = cache->cache_bytes;
+  shared_unlock(&cache->usage_mutex);
+
+  snprintf(buf, size,
+           "objects %d/%d\n"
+           "bodies %d/%d\n"
+           "bytes %d/%d\n"
+           "body_bytes %lld\n"
+           "stored_body_bytes %lld\n"
+           "dedup_saved_bytes %lld\n"
+           "dedup_hits %lld\n",
+           objs, CACHE_OBJS_COUNT, bodies, CACHE_BODY_COUNT, bytes, MAX_CACHE_SIZE,
+           logical, stored, logical - stored, hits);
 }
 
-// LRU 알고리즘을 기반으로 캐시 객체를 삭제한다.
-// 삭제할 캐시를 후보를 선택한다.
-int cache_eviction() 
+// 만료 여부와 관계없이 주어진 URI를 가진 캐시 블록의 인덱스를 찾는다.
+// 같은 URI의 블록이 여러 개 생기지 않도록 cache_uri에서 사용한다.
+int cache_slot(char *uri)
 {
-  // 초기에는 큰 값으로 설정하여 첫 번째 빈 블록을 선택하는 것을 보장한다.
-  // 현재까지 확인한 캐시 블록 중 LRU 값
-  int min = LRU_MAGIC_NUMBER;
-  // 선택한 후보 블록의 인덱스
-  int minindex = 0;
   int i;
-  // 모든 캐시 블록에 대한 루프
-  for (i=0; i<CACHE_OBJS_COUNT; i++) 
+  for (i = 0; i < CACHE_OBJS_COUNT; i++)
   {
-    // 현재 캐시 블록에 대한 읽기 작업
     readerPre(i);
-    // 현재 캐시 블록이 비어 있는 경우
-    // 맴버가 1이면 캐시 블록이 비어 있다.
-    if (cache.cacheobjs[i].isEmpty == 1) 
+    if (cache->cacheobjs[i].isEmpty == 0 && strcmp(uri, cache->cacheobjs[i].cache_url) == 0)
     {
-      // 현재 블록의 인덱스로 설정
-      minindex = i;
-      // 읽기 작업을 완료하고 루프 종료
       readerAfter(i);
-      break;
+      return i;
     }
-    // 현재 캐시 블록의 LRU 값이 현재까지 확인한 최소 LRU 값보다 작은 경우
-    if (cache.cacheobjs[i].LRU < min) 
+    readerAfter(i);
+  }
+  return -1;
+}
+
+// 캐시 블록을 비운다.
+// 잠금을 잡는 사이에 블록이 다른 URL로 교체되었으면 건드리지 않는다.
+void cache_remove(int i, char *url)
+{
+  int removed = 0, len = 0, freed = 0;
+
+  writePre(i);
+  if (cache->cacheobjs[i].isEmpty == 0 && strcmp(url, cache->cacheobjs[i].cache_url) == 0)
+  {
+    cache->cacheobjs[i].isEmpty = 1;
+    len = cache->cacheobjs[i].hdr_len;
+    // 다른 블록이 함께 쓰지 않는 본문이면 본문 풀에서도 풀린다.
+    if (cache->cacheobjs[i].body != -1)
+      len += (freed = body_release(cache->cacheobjs[i].body));
+    cache->cacheobjs[i].body = -1;
+    removed = 1;
+  }
+  writeAfter(i);
+  if (removed)
+  {
+    index_del(i);
+    cache_usage(-len, -1, -(freed > 0));
+  }
+  write_leave();
+}
+
+// URL 색인에서 url 이상인 첫 항목의 위치를 이진 탐색으로 찾는다.
+// 색인 뮤텍스를 잡은 상태에서 호출해야 한다.
+int index_lower_bound(char *url)
+{
+  int lo = 0, hi = cache->url_index_cnt, mid;
+
+  while (lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    if (strcmp(cache->url_index[mid].url, url) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// URL 색인에서 캐시 블록 slot의 항목을 뺀다.
+// 색인 뮤텍스를 잡은 상태에서 호출해야 한다.
+void index_remove_locked(int slot)
+{
+  int i;
+
+  for (i = 0; i < cache->url_index_cnt; i++)
+  {
+    if (cache->url_index[i].slot == slot)
     {
-      // 현재 블록의 인덱스로 설정
-      minindex = i;
-      // min을 현재 블록의 LRU값으로 변경한다.
-      min = cache.cacheobjs[i]. LRU;
-      // 읽기 작업을 완료한다.
-      readerAfter(i);
-      continue;
+      memmove(&cache->url_index[i], &cache->url_index[i + 1],
+              (cache->url_index_cnt - i - 1) * sizeof(url_entry));
+      cache->url_index_cnt--;
+      return;
     }
-    // 읽기 작업을 완료한다.
+  }
+}
+
+// 캐시 블록 slot이 url을 갖게 되었음을 URL 색인에 반영한다.
+// 블록의 이전 URL 항목을 빼고 새 URL을 정렬된 위치에 넣는다.
+void index_set(int slot, char *url)
+{
+  shared_lock(&cache->index_mutex);
+  index_remove_locked(slot);
+  index_insert_locked(slot, url);
+  shared_unlock(&cache->index_mutex);
+}
+
+// URL 색인의 정렬된 위치에 (url, slot) 항목을 넣는다.
+// 색인 뮤텍스를 잡은 상태에서 호출해야 한다.
+void index_insert_locked(int slot, char *url)
+{
+  int pos = index_lower_bound(url);
+
+  memmove(&cache->url_index[pos + 1], &cache->url_index[pos],
+          (cache->url_index_cnt - pos) * sizeof(url_entry));
+  strcpy(cache->url_index[pos].url, url);
+  cache->url_index[pos].slot = slot;
+  cache->url_index_cnt++;
+}
+
+// 비워진 캐시 블록 slot을 URL 색인에서 뺀다.
+void index_del(int slot)
+{
+  shared_lock(&cache->index_mutex);
+  index_remove_locked(slot);
+  shared_unlock(&cache->index_mutex);
+}
+
+// URL이 정확히 같은(prefix가 0) 또는 url로 시작하는(prefix가 1) 캐시 블록을 모두 비운다.
+// 정확히 같은 URL을 비울 때도 그 URL의 gzip 변형은 함께 비운다.
+// 색인에서 접두사 구간만 이진 탐색으로 찾으므로 캐시 전체를 훑지 않는다.
+// 비운 블록의 수를 반환한다.
+int cache_purge(char *url, int prefix)
+{
+  int i, pos, cnt = 0, len = strlen(url);
+  int slots[CACHE_OBJS_COUNT];
+  char urls[CACHE_OBJS_COUNT][MAXLINE];
+
+  // 색인 뮤텍스를 잡은 동안 대상 블록과 URL만 모아 두고
+  // 블록의 쓰기 잠금은 색인 뮤텍스를 놓은 뒤에 잡는다.
+  shared_lock(&cache->index_mutex);
+  for (pos = index_lower_bound(url); pos < cache->url_index_cnt; pos++)
+  {
+    if (strncmp(cache->url_index[pos].url, url, len) != 0)
+      break;
+    // 색인에서 gzip 변형은 원래 URL 바로 뒤에 있다.
+    if (!prefix && cache->url_index[pos].url[len] != '\0'
+        && strcmp(cache->url_index[pos].url + len, CACHE_GZIP_SUFFIX) != 0)
+      break;
+    slots[cnt] = cache->url_index[pos].slot;
+    strcpy(urls[cnt], cache->url_index[pos].url);
+    cnt++;
+  }
+  shared_unlock(&cache->index_mutex);
+
+  for (i = 0; i < cnt; i++)
+    cache_remove(slots[i], urls[i]);
+  return cnt;
+}
+
+// 원격 서버가 tag를 붙인 캐시 블록을 모두 비운다.
+// 비운 블록의 수를 반환한다.
+int cache_purge_tag(char *tag)
+{
+  int i, cnt = 0, match;
+  char key[CACHE_TAGS_LEN + 2], url[MAXLINE];
+
+  // 태그 목록이 공백으로 감싸져 있으므로 " tag "로 찾으면 정확히 일치한다.
+  snprintf(key, sizeof(key), " %s ", tag);
+  for (i = 0; i < CACHE_OBJS_COUNT; i++)
+  {
+    readerPre(i);
+    match = cache->cacheobjs[i].isEmpty == 0 && strstr(cache->cacheobjs[i].tags, key) != NULL;
+    if (match)
+      strcpy(url, cache->cacheobjs[i].cache_url);
     readerAfter(i);
+    if (match)
+    {
+      cache_remove(i, url);
+      cnt++;
+    }
   }
-  // 삭제할 블록을 선택한다.
-  // LRU 알고리즘으로 선정된 후보 블록의 인덱스를 반환한다.
-  return minindex;
+  return cnt;
 }
 
-// 다중 스레드 환경에서 캐시 블록에 대한 쓰기 작업을 동기화한다.
-// 캐시 블록에 대한 쓰기 작업을 시작 전에
-// 해당 캐시 블록의 wmutex 뮤텍스를 잠근다.
-// 다른 스레드와의 동시적인 쓰기 작업 충돌을 방지한다.
-void writePre(int i) 
+// 관리용 듣기 소켓을 루프백 주소(127.0.0.1)에만 연다.
+// 같은 호스트에서만 PURGE 요청을 보낼 수 있다.
+int open_admin_listenfd(char *port)
 {
-  // P함수를 호출하여 캐시 블록의 뮤텍스를 잠근다.
-  // 현재 쓰기 작업을 시작한 스레드가 쓰기 뮤텍스를 소유
-  // 다른 쓰레드는 쓰기 작업이 완료 시까지 대기한다.
-  P(&cache.cacheobjs[i].wmutex);
+  struct addrinfo hints, *listp, *p;
+  int listenfd = -1, optval = 1;
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  if (getaddrinfo("127.0.0.1", port, &hints, &listp) != 0)
+    return -1;
+  for (p = listp; p; p = p->ai_next)
+  {
+    if ((listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+      continue;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval, sizeof(int));
+    if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0 && listen(listenfd, LISTENQ) == 0)
+      break;
+    close(listenfd);
+    listenfd = -1;
+  }
+  freeaddrinfo(listp);
+  return listenfd;
 }
 
-// 다중 스레드 환경에서 캐시 블록에 대한 쓰기 작업을 동기화한다.
-// 캐시 블록에 대한 쓰기 작업이 완료 시 
-// 해당 캐시 블록의 wmutex 뮤텍스를 잠근다.
-// 쓰기 작업의 충돌을 방지하고 쓰기 뮤텍스를 다른 스레드에게 양보한다.
-void writeAfter(int i) 
+// 관리 스레드 - 관리 포트로 들어온 연결을 받아서 연결마다 스레드에 넘긴다.
+// 요청을 보내지 않는 연결 하나가 다른 PURGE와 /stats를 막지 않게 일반 클라이언트처럼 처리한다.
+void *admin_thread(void *vargp)
 {
-  // V함수를 호출하여 캐시 블록의 wmutex 뮤텍스를 해제한다.
-  // 쓰기 작업이 완료된 스레드가 쓰기 뮤텍스를 해제하고
-  // 다른 쓰레드는 쓰기 작업을 수행한다.
-  V(&cache.cacheobjs[i].wmutex);
+  int listenfd = (int)(long)vargp, connfd;
+  socklen_t clientlen;
+  struct sockaddr_storage clientaddr;
+  pthread_t tid;
+
+  Pthread_detach(pthread_self());
+  while (1)
+  {
+    clientlen = sizeof(clientaddr);
+    if ((connfd = accept(listenfd, (SA *)&clientaddr, &clientlen)) < 0)
+      continue;
+    Pthread_create(&tid, NULL, admin_conn_thread, (void *)(long)connfd);
+  }
+  return NULL;
 }
 
-// 캐시 블록 내의 객체의 LRU 값을 업데이트한다.
-// 새로운 객체가 캐시에 저장되거나 읽혔을 때 LRU 값을 조정한다.
-void cache_LRU(int index) 
+// 관리 연결 하나를 처리하는 스레드
+void *admin_conn_thread(void *vargp)
+{
+  int connfd = (int)(long)vargp;
+  struct timeval tv = { ADMIN_TIMEOUT, 0 };
+
+  Pthread_detach(pthread_self());
+  setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  admin_doit(connfd);
+  Close(connfd);
+  return NULL;
+}
+
+// 관리 요청을 처리한다.
+//   PURGE http://host/path HTTP/1.0    - URL이 정확히 같은 블록
+//   PURGE http://host/dir/* HTTP/1.0   - URL이 '*' 앞부분으로 시작하는 블록
+//   PURGE * HTTP/1.0 + Surrogate-Key: a b  - 태그 a 또는 b가 붙은 블록
+//   GET /stats HTTP/1.0                - 캐시 통계(중복 제거로 아낀 바이트 포함)
+void admin_doit(int fd)
+{
+  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], stats[1024];
+  char tags[MAXLINE], *tag, *saveptr;
+  int purged = 0, len, i, tags_len = 0;
+  rio_t rio;
+  http_req_t req;
+  http_header_t *h;
+
+  Rio_readinitb(&rio, fd);
+  http_req_init(&req);
+  if (http_read_request(&rio, &req) != HTTP_PARSE_DONE)
+    return;
+  http_slice_copy(&req.method, method, MAXLINE);
+  if (http_slice_copy(&req.target, uri, MAXLINE) < 0)
+    uri[0] = '\0';
+
+  // 헤더를 훑으면서 태그 목록을 모은다.
+  tags[0] = '\0';
+  for (i = 0; i < req.nheaders; i++)
+  {
+    h = &req.headers[i];
+    if (h->id == HDR_SURROGATE_KEY && tags_len + h->value.len + 1 < MAXLINE)
+      tags_len += sprintf(tags + tags_len, " %.*s", (int)h->value.len, h->value.ptr);
+  }
+
+  if (!strcmp(method, "GET") && !strcmp(uri, "/stats"))
+  {
+    cache_stats(stats, sizeof(stats));
+    snprintf(buf, sizeof(buf), "HTTP/1.0 200 OK\r\n"
+             "Content-type: text/plain\r\n"
+             "Connection: close\r\n"
+             "Content-length: %zu\r\n\r\n%s", strlen(stats), stats);
+    rio_writen(fd, buf, strlen(buf));
+    return;
+  }
+
+  if (strcasecmp(method, "PURGE"))
+  {
+    clienterror(fd, method, "405", "Method Not Allowed", "Admin port only accepts PURGE and GET /stats");
+    return;
+  }
+
+  if (tags[0] != '\0')
+  {
+    for (tag = strtok_r(tags, " \t\r\n,", &saveptr); tag; tag = strtok_r(NULL, " \t\r\n,", &saveptr))
+      purged += cache_purge_tag(tag);
+  }
+  else if ((len = strlen(uri)) > 0 && uri[len - 1] == '*')
+  {
+    uri[len - 1] = '\0';
+    purged = cache_purge(uri, 1);
+  }
+  else if (len > 0)
+    purged = cache_purge(uri, 0);
+
+  sprintf(buf, "HTTP/1.0 200 OK\r\n"
+          "Content-type: text/plain\r\n"
+          "Connection: close\r\n"
+          "X-Purged: %d\r\n\r\n"
+          "purged %d\n", purged, purged);
+  rio_writen(fd, buf, strlen(buf));
+}
+
+// 실패한 호스트 테이블의 뮤텍스를 잡는다.
+// 테이블을 쓰던 프로세스가 도중에 죽었으면 항목이 반쯤 쓰였을 수 있으므로 테이블을 비운다.
+void neg_lock()
 {
   int i;
-  // 모든 캐시 블록에 대한 루프 수행
-  for (i = 0; i < CACHE_OBJS_COUNT; i++) 
+
+  if (shared_lock(&cache->neg_mutex))
+    for (i = 0; i < NEG_HOST_COUNT; i++)
+      cache->neg_hosts[i].expires = 0;
+}
+
+// 실패한 호스트 테이블에서 아직 만료되지 않은 항목을 찾는다.
+// 항목이 있으면 기억해 둔 open_clientfd 반환값(-2 또는 -1), 없으면 0을 반환한다.
+int neg_host_find(char *hostname, int port)
+{
+  int i, err = 0;
+  time_t now = time(NULL);
+
+  neg_lock();
+  for (i = 0; i < NEG_HOST_COUNT; i++)
   {
-    // 현재 반복이 인덱스와 일치하는 경우 다음 반복으로 넘어간다.
-    // 현재 객체의 LRU값을 업데이트x
-    if (i == index) 
+    if (cache->neg_hosts[i].expires > now && cache->neg_hosts[i].port == port
+        && strcasecmp(cache->neg_hosts[i].hostname, hostname) == 0)
+    {
+      err = cache->neg_hosts[i].err;
+      break;
+    }
+  }
+  shared_unlock(&cache->neg_mutex);
+  return err;
+}
+
+// DNS 조회 또는 연결에 실패한 호스트를 NEG_HOST_TTL초 동안 기억한다.
+// 같은 호스트의 항목이나 만료된 항목을 우선 재사용하고
+// 빈 자리가 없으면 가장 먼저 만료될 항목을 교체한다.
+void neg_host_add(char *hostname, int port, int err)
+{
+  int i, victim = 0;
+  time_t now = time(NULL);
+
+  neg_lock();
+  for (i = 0; i < NEG_HOST_COUNT; i++)
+  {
+    if (cache->neg_hosts[i].expires > now && cache->neg_hosts[i].port == port
+        && strcasecmp(cache->neg_hosts[i].hostname, hostname) == 0)
+    {
+      victim = i;
+      break;
+    }
+    if (cache->neg_hosts[i].expires < cache->neg_hosts[victim].expires)
+      victim = i;
+  }
+  strncpy(cache->neg_hosts[victim].hostname, hostname, MAXLINE - 1);
+  cache->neg_hosts[victim].hostname[MAXLINE - 1] = '\0';
+  cache->neg_hosts[victim].port = port;
+  cache->neg_hosts[victim].err = err;
+  cache->neg_hosts[victim].expires = now + NEG_HOST_TTL;
+  shared_unlock(&cache->neg_mutex);
+}
+
+// 갱신 스레드를 시작한다.
+// prefork 모드에서는 작업 프로세스마다 갱신 스레드를 띄우고 공유된 작업 테이블을 함께 쓴다.
+void refresh_init()
+{
+  int i;
+  pthread_t tid;
+
+  // 작업 테이블은 cache_init에서 캐시와 함께 초기화된다.
+  for (i = 0; i < REFRESH_THREADS; i++)
+    Pthread_create(&tid, NULL, refresh_thread, NULL);
+}
+
+// 만료된 URL의 갱신을 예약한다.
+// 같은 URL이 이미 대기 중이거나 진행 중이면 아무것도 하지 않고
+// 테이블이 가득 차 있으면 다음 요청에서 다시 시도하도록 버린다.
+void refresh_enqueue(char *url)
+{
+  int i, empty = -1;
+
+  shared_lock(&cache->refresh.mutex);
+  for (i = 0; i < REFRESH_QUEUE_SIZE; i++)
+  {
+    if (cache->refresh.jobs[i].state == 0)
     {
+      if (empty == -1)
+        empty = i;
       continue;
     }
-    // 현재 캐시 블록에 대한 쓰기 작업
-    writePre(i);
-    // 현재 블록이 비어있지 않는 경우
-    // 해당 캐시 블록의 LRU 값을 감소한다.
-    // LRU 값이 낮아지면서 해당 객체가 더 최근에 사용되었을 표시한다.
-    if (cache.cacheobjs[i].isEmpty == 0) 
+    if (strcmp(cache->refresh.jobs[i].url, url) == 0)
     {
-      cache.cacheobjs[i].LRU--;
+      shared_unlock(&cache->refresh.mutex);
+      return;
     }
-    // 현재 캐시 블록에 대한 쓰기 작업을 완료한다.
-    writeAfter(i);
   }
+  if (empty != -1)
+  {
+    strcpy(cache->refresh.jobs[empty].url, url);
+    cache->refresh.jobs[empty].state = 1;
+  }
+  shared_unlock(&cache->refresh.mutex);
+  // 대기 중인 작업이 생겼음을 갱신 스레드에게 알린다.
+  if (empty != -1)
+    V(&cache->refresh.items);
 }
 
-// URI에 대한 캐시 업데이트 작업
-void cache_uri(char *uri, char *buf) 
+// 갱신 스레드 - 대기 중인 작업을 하나씩 꺼내 원격 서버로부터 다시 가져온다.
+void *refresh_thread(void *vargp)
 {
-  // 캐시에서 삭제할 후보 블록의 인덱스를 가져온다.
-  int i = cache_eviction();
-  
-  // 선택된 캐시 블록에 대한 쓰기 작업 수행
-  // 다른 스레드가 동시에 캐시 블록을 수정x
-  writePre(i);
+  int i;
+  char url[MAXLINE];
 
-  // 캐시에 데이터 저장 - 선택된 캐시 블록에 버퍼 내용을 복사
-  strcpy(cache.cacheobjs[i].cache_obj, buf);
-  // 캐시에 URI 식별 - 선택된 캐시 블록에 URI를 복사
-  strcpy(cache.cacheobjs[i].cache_url, uri);
-  // 선택된 캐시 블록이 비어 있지 않는 상태 표시
-  cache.cacheobjs[i].isEmpty = 0;
-  // 객체가 최근에 사용됨을 표시한다.
-  // 선택된 캐시 블록의 LRU 값을 LRU 매직 넘버로 설정
-  cache.cacheobjs[i].LRU = LRU_MAGIC_NUMBER;
-  // 현재 객체가 가장 최근에 사용됨을 표시 - LRU값 업데이트
-  cache_LRU(i);
-  // 쓰기 작업을 완료
-  // 다른 쓰레드가 캐시 블록에 대한 작업을 수행 가능 상태
-  writeAfter(i);
+  Pthread_detach(pthread_self());
+  while (1)
+  {
+    // 대기 중인 작업이 생길 때까지 기다린다.
+    P(&cache->refresh.items);
+    shared_lock(&cache->refresh.mutex);
+    for (i = 0; i < REFRESH_QUEUE_SIZE; i++)
+      if (cache->refresh.jobs[i].state == 1)
+        break;
+    if (i == REFRESH_QUEUE_SIZE)
+    {
+      shared_unlock(&cache->refresh.mutex);
+      continue;
+    }
+    // 진행 중으로 표시해서 같은 URL이 다시 예약되지 않게 한다.
+    cache->refresh.jobs[i].state = 2;
+    cache->refresh.jobs[i].owner = cache_pid;
+    strcpy(url, cache->refresh.jobs[i].url);
+    shared_unlock(&cache->refresh.mutex);
+
+    refresh_uri(url);
+
+    // 작업을 끝내고 항목을 비운다.
+    shared_lock(&cache->refresh.mutex);
+    cache->refresh.jobs[i].state = 0;
+    shared_unlock(&cache->refresh.mutex);
+  }
+  return NULL;
+}
+
+// URL을 원격 서버로부터 다시 가져와서 캐시 블록을 교체한다.
+// 원격 서버가 실패하거나 5xx를 보내면 기존 블록을 그대로 두어
+// stale-if-error 기간 동안 계속 제공되게 한다.
+void refresh_uri(char *url)
+{
+  char uri[MAXLINE], hostname[MAXLINE], path[MAXLINE];
+  iov_list ureq;
+  char *cachebuf;
+  int port, end_serverfd, sizebuf = -1, i;
+  rio_t server_rio;
+  http_req_t resp;
+
+  // parse_uri가 문자열을 바꾸므로 복사해서 사용한다.
+  strcpy(uri, url);
+  path[0] = '\0';
+  parse_uri(uri, hostname, path, &port);
+  // 클라이언트 헤더 없이 기본 헤더만으로 요청을 만든다.
+  build_http_header(&ureq, "GET", hostname, path, NULL);
+
+  if (neg_host_find(hostname, port) != 0)
+    return;
+  if ((end_serverfd = connect_endServer(hostname, port)) < 0)
+  {
+    neg_host_add(hostname, port, end_serverfd);
+    return;
+  }
+
+  // 요청을 보내고 응답 전체를 읽는다.
+  // 갱신 스레드가 종료되지 않도록 오류 시 종료하는 대문자 래퍼 대신 rio 함수를 직접 쓴다.
+  Rio_readinitb(&server_rio, end_serverfd);
+  if (rio_writev(end_serverfd, ureq.iov, ureq.cnt) < 0)
+  {
+    Close(end_serverfd);
+    return;
+  }
+  cachebuf = Malloc(MAX_OBJECT_SIZE);
+  // 클라이언트 없이(connfd -1) 응답 본문의 길이대로 읽어서 모으기만 한다.
+  http_resp_init(&resp);
+  if (http_read_response(&server_rio, &resp) == HTTP_PARSE_DONE)
+    sizebuf = relay_response(&server_rio, -1, &resp, cachebuf, 0, NULL);
+  Close(end_serverfd);
+
+  // 캐시에 넣을 수 있는 크기의 정상 응답만 기존 블록을 교체한다.
+  if (sizebuf > 0 && sizebuf < MAX_OBJECT_SIZE && resp.status >= 200 && resp.status < 500)
+  {
+    cachebuf[sizebuf] = '\0';
+    cache_uri(url, cachebuf, sizebuf);
+    // 예전 본문으로 만든 gzip 변형은 버린다 - 다음 gzip 요청이 새 블록으로 다시 만든다.
+    if (strlen(url) + strlen(CACHE_GZIP_SUFFIX) < MAXLINE)
+    {
+      strcat(strcpy(uri, url), CACHE_GZIP_SUFFIX);
+      if ((i = cache_slot(uri)) != -1)
+        cache_remove(i, uri);
+    }
+  }
+  Free(cachebuf);
 }
@@ -0,0 +1,147 @@
+/*
+ * riobench.c - rio 줄 단위 읽기 함수의 처리량 비교
+ *
+ * HTTP 헤더처럼 생긴 줄로 채운 임시 파일을 만들고
+ * 예전 rio_readlineb(한 바이트마다 rio_read 호출),
+ * memchr로 줄을 찾는 지금의 rio_readlineb,
+ * 복사하지 않는 rio_getlineb로 끝까지 읽으면서 초당 바이트 수를 잰다.
+ *
+ * usage: riobench [MB]
+ */
+#include <time.h>
+#include "csapp.h"
+
+#define BENCH_RUNS 3
+
+/* 비교용 - memchr 적용 이전 csapp.c의 rio_read / rio_readlineb */
+static ssize_t old_rio_read(rio_t *rp, char *usrbuf, size_t n)
+{
+    int cnt;
+
+    while (rp->rio_cnt <= 0) {
+        rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, sizeof(rp->rio_buf));
+        if (rp->rio_cnt < 0) {
+            if (errno != EINTR)
+                return -1;
+        }
+        else if (rp->rio_cnt == 0)
+            return 0;
+        else
+            rp->rio_bufptr = rp->rio_buf;
+    }
+    cnt = n;
+    if (rp->rio_cnt < n)
+        cnt = rp->rio_cnt;
+    memcpy(usrbuf, rp->rio_bufptr, cnt);
+    rp->rio_bufptr += cnt;
+    rp->rio_cnt -= cnt;
+    return cnt;
+}
+
+static ssize_t old_rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
+{
+    int n, rc;
+    char c, *bufp = usrbuf;
+
+    for (n = 1; n < maxlen; n++) {
+        if ((rc = old_rio_read(rp, &c, 1)) == 1) {
+            *bufp++ = c;
+            if (c == '\n') {
+                n++;
+                break;
+            }
+        } else if (rc == 0) {
+            if (n == 1)
+                return 0;
+            else
+                break;
+        } else
+            return -1;
+    }
+    *bufp = 0;
+    return n-1;
+}
+
+/* 헤더처럼 생긴 줄로 size 바이트 남짓을 채운 임시 파일을 만든다. */
+static int make_input(size_t size)
+{
+    char tmpl[] = "/tmp/riobenchXXXXXX", line[MAXLINE];
+    size_t total = 0;
+    int fd, len, pad, i = 0;
+
+    if ((fd = mkstemp(tmpl)) < 0)
+        unix_error("mkstemp error");
+    unlink(tmpl);
+    srand(1);
+    while (total < size) {
+        /* 짧은 헤더부터 긴 쿠키 헤더까지 길이를 섞는다. */
+        len = sprintf(line, "X-Header-%d: ", i++);
+        pad = rand() % 300;
+        memset(line + len, 'a' + rand() % 26, pad);
+        len += pad;
+        len += sprintf(line + len, "\r\n");
+        Rio_writen(fd, line, len);
+        total += len;
+    }
+    return fd;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 파일 전체를 한 가지 방법으로 읽고 걸린 시간을 돌려준다. */
+static double run(int fd, int mode, size_t *bytes)
+{
+    rio_t rio;
+    char buf[MAXLINE], *line;
+    ssize_t n;
+    double start;
+
+    Lseek(fd, 0, SEEK_SET);
+    Rio_readinitb(&rio, fd);
+    *bytes = 0;
+    start = now();
+    while (1) {
+        if (mode == 0)
+            n = old_rio_readlineb(&rio, buf, MAXLINE);
+        else if (mode == 1)
+            n = rio_readlineb(&rio, buf, MAXLINE);
+        else
+            n = rio_getlineb(&rio, &line);
+        if (n <= 0)
+            break;
+        *bytes += n;
+    }
+    return now() - start;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *names[] = {"old rio_readlineb", "rio_readlineb", "rio_getlineb"};
+    size_t mb = 64, bytes;
+    double t, best;
+    int fd, mode, i;
+
+    if (argc > 1)
+        mb = atoi(argv[1]);
+    fd = make_input(mb << 20);
+
+    for (mode = 0; mode < 3; mode++) {
+        /* 페이지 캐시가 데워진 뒤의 가장 빠른 결과를 쓴다. */
+        best = 0;
+        for (i = 0; i < BENCH_RUNS; i++) {
+            t = run(fd, mode, &bytes);
+            if (best == 0 || t < best)
+                best = t;
+        }
+        printf("%-18s %8.1f MB/s (%zu bytes, %.3f s)\n",
+               names[mode], bytes / best / (1 << 20), bytes, best);
+    }
+    Close(fd);
+    exit(0);
+}
@@ -6,8 +6,11 @@
  // 웹 브라우저에서 프로그램 호출 시 
  // 쿼리 문자열에서 추출한 두 숫자를 더한 결과를 HTML 페이지로 반환한다.
 #include "csapp.h"
+// tiny의 상주 워커 풀에서 여러 요청을 처리한다.
+#include "tcgi.h"
 
-int main(void) {
+// 요청 하나를 처리한다.
+static void add(void) {
     char* buf, * p, * method;
     char arg1[MAXLINE], arg2[MAXLINE], content[MAXLINE];
     int n1 = 0, n2 = 0;
@@ -18,13 +21,15 @@ int main(void) {
     if ((buf = getenv("QUERY_STRING")) != NULL) {
         // 쿼리 문자열에서 두 개의 인자를 추출한다.
         // & 문자를 기준으로 두 순자를 분리한다.
-        p = strchr(buf, '&');
-        *p = '\0';
-        strcpy(arg1, buf);
-        strcpy(arg2, p + 1);
-        // atoi 함수를 사용하여 정수로 변환한다.
-        n1 = atoi(arg1);
-        n2 = atoi(arg2);
+        // 상주 워커는 잘못된 요청 하나로 죽지 않도록 &가 없으면 건너뛴다.
+        if ((p = strchr(buf, '&')) != NULL) {
+            *p = '\0';
+            strcpy(arg1, buf);
+            strcpy(arg2, p + 1);
+            // atoi 함수를 사용하여 정수로 변환한다.
+            n1 = atoi(arg1);
+            n2 = atoi(arg2);
+        }
     }
 
     /* Make the response body */
@@ -49,8 +54,14 @@ int main(void) {
     if (strcasecmp(method, "HEAD") != 0)
         printf("%s", content);
     */
-    // 출력 버퍼를 비우고 프로그램을 종료
+    // 출력 버퍼를 비운다.
     fflush(stdout);
+}
+
+int main(void) {
+    // 요청마다 한 번씩 돈다. 일반 CGI로 실행되면 한 번만 돌고 종료한다.
+    while (tcgi_accept() > 0)
+        add();
 
     exit(0);
 }
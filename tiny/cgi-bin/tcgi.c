@@ -0,0 +1,126 @@
+/*
+ * tcgi.c - tiny 상주 CGI 워커 라이브러리
+ *
+ * 상주 모드에서는 표준 입력(0번)이 tiny와 이어진 소켓이다.
+ * 프레임 규약은 ../cgipool.h에 적혀 있다.
+ * 표준 출력(1번)은 임시 파일로 돌려 두고 요청마다 처음부터 다시 쓴다.
+ * stdout FILE은 그대로 두므로 printf를 쓰는 프로그램을 고치지 않아도 된다.
+ */
+#include "csapp.h"
+#include "tcgi.h"
+#include "cgipool.h"
+
+static int persistent = -1;     /* -1이면 첫 호출 전, 0이면 일반 CGI, 1이면 상주 워커 */
+static int served;              /* 일반 CGI로 요청을 처리했는지 */
+static int collecting;          /* 처리 중인 요청의 출력이 표준 출력에 쌓이고 있는지 */
+
+static int readn(int fd, void *buf, size_t n)
+{
+    char *p = buf;
+    ssize_t r;
+
+    while (n > 0) {
+        if ((r = read(fd, p, n)) < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+static int writen(int fd, void *buf, size_t n)
+{
+    char *p = buf;
+    ssize_t r;
+
+    while (n > 0) {
+        if ((r = write(fd, p, n)) < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+// 임시 파일에 모인 표준 출력을 응답 프레임 하나로 보내고 파일을 비운다.
+static int send_response(void)
+{
+    char *outbuf;
+    long outlen;
+    uint32_t hdr;
+    int rc = -1;
+
+    collecting = 0;
+    if (fflush(stdout) == EOF || (outlen = ftell(stdout)) < 0)
+        return -1;
+    if ((outbuf = malloc(outlen + 1)) &&
+        pread(STDOUT_FILENO, outbuf, outlen, 0) == outlen) {
+        hdr = htonl(outlen);
+        if (writen(STDIN_FILENO, &hdr, 4) == 0 && writen(STDIN_FILENO, outbuf, outlen) == 0)
+            rc = 0;
+    }
+    free(outbuf);
+    // 다음 요청은 파일 처음부터 쓴다.
+    rewind(stdout);
+    if (ftruncate(STDOUT_FILENO, 0) < 0)
+        return -1;
+    return rc;
+}
+
+/*
+ * 다음 요청을 기다린다. 요청이 오면 환경 변수를 설정하고 1,
+ * 더 처리할 요청이 없으면(tiny가 워커를 닫았으면) 0을 돌려준다.
+ */
+int tcgi_accept(void)
+{
+    char *req, *p;
+    uint32_t hdr;
+    size_t len;
+    FILE *tmp;
+
+    if (persistent < 0) {
+        persistent = getenv("TINY_CGI") != NULL;
+        if (persistent) {
+            // 처음 표준 출력은 첫 요청을 보낸 클라이언트 소켓이다.
+            // 응답은 프레임으로 보내므로 놓아 주어야 클라이언트 연결이 닫힌다.
+            // 대신 읽고 쓸 수 있는 임시 파일을 1번에 두고 요청마다 출력을 모은다.
+            fflush(stdout);
+            if (!(tmp = tmpfile()) || dup2(fileno(tmp), STDOUT_FILENO) < 0)
+                return 0;
+            fclose(tmp);
+            if (writen(STDIN_FILENO, CGI_MAGIC, 4) < 0)
+                return 0;
+        }
+    }
+    if (!persistent)
+        return served++ == 0;
+
+    // 앞 요청의 응답을 마무리한다.
+    if (collecting && send_response() < 0)
+        return 0;
+
+    if (readn(STDIN_FILENO, &hdr, 4) < 0)
+        return 0;
+    len = ntohl(hdr);
+    if (!(req = malloc(len + 1)) || readn(STDIN_FILENO, req, len) < 0)
+        return 0;
+    req[len] = '\0';
+    // "이름=값\0" 쌍들을 환경 변수로 옮긴다.
+    for (p = req; p < req + len; p += strlen(p) + 1) {
+        char *eq = strchr(p, '=');
+
+        if (eq) {
+            *eq = '\0';
+            setenv(p, eq + 1, 1);
+        }
+    }
+    free(req);
+
+    // 이번 요청의 printf 출력은 표준 출력의 임시 파일에 모인다.
+    collecting = 1;
+    return 1;
+}
@@ -0,0 +1,20 @@
+/*
+ * tcgi.h - tiny 상주 CGI 워커 라이브러리
+ *
+ * CGI 프로그램의 본문을 tcgi_accept() 루프로 감싸면 tiny가 프로그램을 한 번 띄워 놓고
+ * 여러 요청에 다시 쓴다. 요청마다 QUERY_STRING, REQUEST_METHOD 환경 변수가 설정되고
+ * 표준 출력에 쓴 내용이 응답이 되므로 일반 CGI와 똑같이 작성하면 된다.
+ *
+ *     while (tcgi_accept() > 0) {
+ *         ... getenv("QUERY_STRING") ... printf(...) ...
+ *     }
+ *
+ * tiny의 워커 풀 밖에서(다른 서버나 명령줄에서) 실행하면 첫 호출만 1을 돌려주므로
+ * 그대로 일반 CGI 프로그램으로 동작한다.
+ */
+#ifndef __TCGI_H__
+#define __TCGI_H__
+
+int tcgi_accept(void);
+
+#endif /* __TCGI_H__ */
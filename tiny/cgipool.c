@@ -0,0 +1,271 @@
+/*
+ * cgipool.c - 상주 CGI 워커 풀
+ *
+ * 프로그램마다 놀고 있는 워커 목록을 두고 작업 스레드가 하나씩 빌려 쓴다.
+ * 놀고 있는 워커가 없으면 새로 띄우므로 동시에 도는 워커 수는 작업 스레드 수를 넘지 않는다.
+ * 프로그램 파일이 바뀌면(다시 빌드하면) 옛 워커들은 버리고 새로 띄운다.
+ */
+#include "cgipool.h"
+
+typedef struct cgi_worker {
+    int fd;                      /* 워커의 표준 입력과 이어진 소켓 */
+    pid_t pid;
+    int gen;                     /* 띄울 때의 프로그램 세대 */
+    struct cgi_worker *next;
+} cgi_worker;
+
+typedef struct {
+    char path[MAXLINE];
+    dev_t dev;                   /* 띄운 워커가 실행 중인 파일 */
+    ino_t ino;
+    struct timespec mtime;
+    int classic;                 /* 상주 모드를 모르는 일반 CGI 프로그램 */
+    int gen;                     /* 파일이 바뀔 때마다 올라간다 */
+    cgi_worker *idle;
+    int nidle;
+} cgi_prog;
+
+static cgi_prog progs[CGI_MAX_PROGS];
+static int nprogs;
+static pthread_mutex_t cgipool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void cgipool_init(void)
+{
+    nprogs = 0;
+}
+
+/*
+ * CGI 프로그램에게 줄 환경 변수 목록 - tiny의 환경에 QUERY_STRING, REQUEST_METHOD와
+ * extra(NULL이 아니면)를 더한다. 목록과 새 문자열이 한 블록이라 Free 한 번으로 해제한다.
+ * 여러 스레드가 도는 프로세스에서 fork한 자식은 exec 전까지 잠금을 잡는 함수(setenv, malloc)를
+ * 부르면 다른 스레드가 잡고 있던 잠금 때문에 멈출 수 있으므로 fork 전에 부모에서 만든다.
+ */
+char **cgi_env(char *cgiargs, char *method, char *extra)
+{
+    size_t qlen = strlen("QUERY_STRING=") + strlen(cgiargs) + 1;
+    size_t mlen = strlen("REQUEST_METHOD=") + strlen(method) + 1;
+    char **envp, *p;
+    int n, i, j;
+
+    for (n = 0; environ[n]; n++)
+        ;
+    envp = Malloc((n + 4) * sizeof(char *) + qlen + mlen);
+    p = (char *)(envp + n + 4);
+    for (i = j = 0; i < n; i++)
+        if (strncmp(environ[i], "QUERY_STRING=", 13) && strncmp(environ[i], "REQUEST_METHOD=", 15))
+            envp[j++] = environ[i];
+    // QUERY_STRING - CGI 프로그램에게 클라이언트로부터 전달된 CGI인자 전달
+    sprintf(p, "QUERY_STRING=%s", cgiargs);
+    envp[j++] = p;
+    p += qlen;
+    // 11.11 REQUEST_METHOD
+    sprintf(p, "REQUEST_METHOD=%s", method);
+    envp[j++] = p;
+    if (extra)
+        envp[j++] = extra;
+    envp[j] = NULL;
+    return envp;
+}
+
+// 워커를 끝낸다. 규약이 어긋났을 수 있으므로 기다리지 않고 죽인다.
+static void worker_kill(cgi_worker *w)
+{
+    close(w->fd);
+    kill(w->pid, SIGKILL);
+    waitpid(w->pid, NULL, 0);
+    Free(w);
+}
+
+// 놀고 있는 워커를 끝낸다. 소켓을 닫으면 워커는 EOF를 읽고 스스로 끝난다.
+static void worker_close(cgi_worker *w)
+{
+    close(w->fd);
+    waitpid(w->pid, NULL, 0);
+    Free(w);
+}
+
+// filename의 프로그램 항목을 찾거나 만든다. cgipool_mutex를 잡고 부른다.
+// 파일이 바뀌었으면 옛 워커들을 *stale로 넘겨서 잠금 밖에서 끝내게 한다.
+static cgi_prog *prog_lookup(char *filename, struct stat *st, cgi_worker **stale)
+{
+    cgi_prog *p;
+    int i;
+
+    for (i = 0; i < nprogs; i++)
+        if (!strcmp(progs[i].path, filename))
+            break;
+    if (i == nprogs) {
+        if (nprogs == CGI_MAX_PROGS || strlen(filename) >= MAXLINE)
+            return NULL;
+        p = &progs[nprogs++];
+        strcpy(p->path, filename);
+        p->idle = NULL;
+        p->nidle = 0;
+        p->gen = 0;
+    }
+    else {
+        p = &progs[i];
+        if (p->dev == st->st_dev && p->ino == st->st_ino &&
+            p->mtime.tv_sec == st->st_mtim.tv_sec && p->mtime.tv_nsec == st->st_mtim.tv_nsec)
+            return p;
+        *stale = p->idle;
+        p->idle = NULL;
+        p->nidle = 0;
+        p->gen++;
+    }
+    p->dev = st->st_dev;
+    p->ino = st->st_ino;
+    p->mtime = st->st_mtim;
+    p->classic = 0;
+    return p;
+}
+
+/*
+ * 워커 하나에게 요청을 넘기고 응답 프레임을 클라이언트 fd로 옮긴다.
+ * 반환값: 0 - 응답을 다 옮겼고 워커를 다시 쓸 수 있다.
+ *        -1 - 응답 도중에 워커가 끊겼다(클라이언트에게 일부가 나갔다).
+ *        -2 - 클라이언트에게 아무것도 보내기 전에 워커가 끊겼다.
+ * 클라이언트가 도중에 끊겨도 워커와의 프레임은 끝까지 읽어서 다음 요청과 어긋나지 않게 한다.
+ */
+static int worker_request(cgi_worker *w, int fd, char *cgiargs, char *method)
+{
+    char buf[MAXBUF];
+    uint32_t hdr;
+    size_t len, n;
+    int client_ok = 1;
+
+    len = snprintf(buf + 4, sizeof(buf) - 4, "QUERY_STRING=%s%cREQUEST_METHOD=%s%c",
+                   cgiargs, '\0', method, '\0');
+    if (len >= sizeof(buf) - 4)
+        return -2;
+    hdr = htonl(len);
+    memcpy(buf, &hdr, 4);
+    if (rio_writen(w->fd, buf, len + 4) != (ssize_t)(len + 4))
+        return -2;
+
+    if (rio_readn(w->fd, &hdr, 4) != 4)
+        return -2;
+    for (len = ntohl(hdr); len > 0; len -= n) {
+        n = len < sizeof(buf) ? len : sizeof(buf);
+        if (rio_readn(w->fd, buf, n) != (ssize_t)n)
+            return -1;
+        if (client_ok && rio_writen(fd, buf, n) != (ssize_t)n)
+            client_ok = 0;
+    }
+    return 0;
+}
+
+/*
+ * 새 워커를 띄운다. 표준 출력은 클라이언트 소켓, 표준 입력은 tiny와 이어진 소켓이다.
+ * 상주 모드를 아는 프로그램이면 매직을 보내고 표준 출력을 놓으므로 워커를 돌려준다.
+ * 모르는 프로그램이면 일반 CGI처럼 이번 요청의 응답을 클라이언트에게 직접 쓰고 끝나므로
+ * NULL을 돌려주고 *classic을 1로 둔다.
+ */
+static cgi_worker *worker_spawn(int fd, char *filename, char *cgiargs, char *method, int gen, int *classic)
+{
+    char *emptylist[] = { NULL }, **envp, magic[4];
+    int sv[2];
+    ssize_t n;
+    pid_t pid;
+    cgi_worker *w;
+
+    *classic = 0;
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+        return NULL;
+    envp = cgi_env(cgiargs, method, "TINY_CGI=1");
+    if ((pid = Fork()) == 0) {
+        Dup2(fd, STDOUT_FILENO);
+        Dup2(sv[1], STDIN_FILENO);
+        Execve(filename, emptylist, envp);
+    }
+    Free(envp);
+    close(sv[1]);
+
+    if ((n = rio_readn(sv[0], magic, 4)) != 4 || memcmp(magic, CGI_MAGIC, 4)) {
+        // 일반 CGI - 표준 입력을 닫았으면(EOF) 응답을 쓰고 있거나 다 썼으니 끝나기를 기다린다.
+        // 매직 대신 다른 것을 보냈으면 규약을 모르는 것이므로 끝낸다.
+        close(sv[0]);
+        if (n != 0)
+            kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        *classic = 1;
+        return NULL;
+    }
+    w = Malloc(sizeof(cgi_worker));
+    w->fd = sv[0];
+    w->pid = pid;
+    w->gen = gen;
+    w->next = NULL;
+    return w;
+}
+
+/*
+ * filename CGI 프로그램의 응답을 상주 워커로 만들어 fd로 보낸다.
+ * 응답을 보냈으면(일반 CGI로 판명되어 직접 보낸 경우 포함) 1,
+ * 이 프로그램은 풀로 돌릴 수 없으니 호출자가 fork/execve 해야 하면 0을 돌려준다.
+ */
+int cgipool_serve(int fd, char *filename, struct stat *st, char *cgiargs, char *method)
+{
+    cgi_prog *p;
+    cgi_worker *w, *stale = NULL, *next;
+    int rc, classic, gen;
+
+    pthread_mutex_lock(&cgipool_mutex);
+    p = prog_lookup(filename, st, &stale);
+    if (!p || p->classic) {
+        pthread_mutex_unlock(&cgipool_mutex);
+        for (; stale; stale = next) {
+            next = stale->next;
+            worker_close(stale);
+        }
+        return 0;
+    }
+    if ((w = p->idle)) {
+        p->idle = w->next;
+        p->nidle--;
+    }
+    gen = p->gen;
+    pthread_mutex_unlock(&cgipool_mutex);
+    for (; stale; stale = next) {
+        next = stale->next;
+        worker_close(stale);
+    }
+
+    // 놀고 있던 워커에게 먼저 맡긴다.
+    // 그사이 죽은 워커라서 아무것도 보내지 못했으면 새 워커를 띄워 다시 한다.
+    if (w) {
+        if ((rc = worker_request(w, fd, cgiargs, method)) == 0)
+            goto done;
+        worker_kill(w);
+        if (rc == -1)
+            return 1;
+    }
+
+    if (!(w = worker_spawn(fd, filename, cgiargs, method, gen, &classic))) {
+        if (!classic)
+            return 0;
+        pthread_mutex_lock(&cgipool_mutex);
+        if (p->gen == gen)
+            p->classic = 1;
+        pthread_mutex_unlock(&cgipool_mutex);
+        return 1;
+    }
+    if (worker_request(w, fd, cgiargs, method) < 0) {
+        worker_kill(w);
+        return 1;
+    }
+
+ done:
+    // 다 쓴 워커는 목록에 돌려 놓는다. 이미 충분히 놀고 있거나 그사이 파일이 바뀌었으면 끝낸다.
+    pthread_mutex_lock(&cgipool_mutex);
+    if (p->nidle < CGI_MAX_IDLE && w->gen == p->gen) {
+        w->next = p->idle;
+        p->idle = w;
+        p->nidle++;
+        w = NULL;
+    }
+    pthread_mutex_unlock(&cgipool_mutex);
+    if (w)
+        worker_close(w);
+    return 1;
+}
@@ -0,0 +1,28 @@
+/*
+ * cgipool.h - 상주 CGI 워커 풀
+ *
+ * 요청마다 fork/execve 하지 않고 CGI 프로그램을 워커 프로세스로 띄워 둔 채
+ * 유닉스 도메인 소켓으로 요청을 넘기고 응답을 받아 온다.
+ *
+ * 워커 쪽 규약(cgi-bin/tcgi.h가 구현한다)
+ *   - 환경 변수 TINY_CGI가 있고 표준 입력(0번)이 tiny와 연결된 소켓이면 상주 모드다.
+ *   - 시작하자마자 CGI_MAGIC 4바이트를 보낸다.
+ *   - 요청 프레임: 4바이트 길이(네트워크 바이트 순서) + "QUERY_STRING=...\0REQUEST_METHOD=...\0"
+ *   - 응답 프레임: 4바이트 길이 + 일반 CGI가 표준 출력에 쓰는 것과 같은 내용
+ * 이 규약을 모르는 일반 CGI 프로그램은 처음 한 번 띄웠을 때 매직 없이 끝나므로
+ * 그 프로그램은 이후로 예전처럼 요청마다 fork/execve 한다.
+ */
+#ifndef __CGIPOOL_H__
+#define __CGIPOOL_H__
+
+#include "csapp.h"
+
+#define CGI_MAGIC "TCGI"
+#define CGI_MAX_PROGS 16     /* 풀을 두는 CGI 프로그램 수 */
+#define CGI_MAX_IDLE 4       /* 프로그램마다 놀려 두는 워커 수 - 넘치면 끝낸다 */
+
+void cgipool_init(void);
+int cgipool_serve(int fd, char *filename, struct stat *st, char *cgiargs, char *method);
+char **cgi_env(char *cgiargs, char *method, char *extra);
+
+#endif /* __CGIPOOL_H__ */
@@ -0,0 +1,303 @@
+/*
+ * fcache.c - 정적 파일의 열린 식별자와 stat 결과 캐시
+ *
+ * 작업 스레드들이 함께 쓰므로 테이블과 LRU 목록은 mutex 하나로 보호한다.
+ * 항목은 참조 수를 세어서, 사용 중에 내보내지거나 바뀐 파일로 교체되어도
+ * 마지막 요청이 fcache_put할 때까지 식별자를 닫지 않는다.
+ */
+#include "fcache.h"
+
+static fcache_ent *table[FCACHE_BUCKETS];
+static fcache_ent *lru_head, *lru_tail;
+static int nentries;
+static pthread_mutex_t fcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fcache_build_fn build_resp;   /* 새 항목의 응답을 만드는 함수 */
+
+static unsigned fcache_hash(char *path)
+{
+    unsigned h = 5381;
+
+    while (*path)
+        h = h * 33 + (unsigned char)*path++;
+    return h % FCACHE_BUCKETS;
+}
+
+// 파일이 캐시해 둔 것과 같은지 - 교체되었거나 내용이 바뀌면 다르다.
+static int same_file(struct stat *a, struct stat *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_size == b->st_size && a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+           a->st_mtim.tv_nsec == b->st_mtim.tv_nsec && a->st_mode == b->st_mode;
+}
+
+// 참조를 하나 내려놓고 마지막 참조였으면 식별자를 닫는다. fcache_mutex를 잡고 부른다.
+static void ent_release(fcache_ent *e)
+{
+    if (--e->refcnt > 0)
+        return;
+    if (e->fd >= 0)
+        close(e->fd);
+    Free(e->resp);
+    if (e->path != e->key)
+        Free(e->path);
+    Free(e->key);
+    Free(e);
+}
+
+static fcache_ent *ent_lookup(char *key, unsigned h)
+{
+    fcache_ent *e;
+
+    for (e = table[h]; e; e = e->hnext)
+        if (!strcmp(e->key, key))
+            return e;
+    return NULL;
+}
+
+static void lru_unlink(fcache_ent *e)
+{
+    if (e->prev) e->prev->next = e->next; else lru_head = e->next;
+    if (e->next) e->next->prev = e->prev; else lru_tail = e->prev;
+}
+
+static void lru_push(fcache_ent *e)
+{
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head) lru_head->prev = e; else lru_tail = e;
+    lru_head = e;
+}
+
+// 테이블과 LRU 목록에서 빼고 캐시의 참조를 내려놓는다.
+static void ent_remove(fcache_ent *e)
+{
+    fcache_ent **pp;
+
+    for (pp = &table[fcache_hash(e->key)]; *pp != e; pp = &(*pp)->hnext)
+        ;
+    *pp = e->hnext;
+    lru_unlink(e);
+    nentries--;
+    ent_release(e);
+}
+
+// build는 새 항목마다 한 번 불려서 e->resp, head_len, resp_len을 채운다.
+// 새 항목을 만든다. 참조는 캐시와 호출자 몫으로 둘이다.
+// 응답은 잠금 밖에서 만든다 - 작은 파일은 여기서 본문을 한 번 읽어 둔다.
+static fcache_ent *ent_new(char *key, char *path, int fd, struct stat *st, int gzip, time_t now)
+{
+    fcache_ent *e = Malloc(sizeof(fcache_ent));
+
+    e->key = Malloc(strlen(key) + 1);
+    strcpy(e->key, key);
+    if (strcmp(path, key)) {
+        e->path = Malloc(strlen(path) + 1);
+        strcpy(e->path, path);
+    }
+    else
+        e->path = e->key;
+    e->fd = fd;
+    e->st = *st;
+    e->src = *st;
+    e->gzip = gzip;
+    e->size = st->st_size;
+    e->checked = now;
+    e->refcnt = 2;               /* 캐시 + 호출자 */
+    e->resp = NULL;
+    e->head_len = e->resp_len = 0;
+    if (gzip != FCACHE_GZIP_NONE)
+        build_resp(e);
+    return e;
+}
+
+// 항목을 테이블에 넣는다. fcache_mutex를 잡고 부른다.
+static void ent_insert(fcache_ent *e, unsigned h)
+{
+    fcache_ent *old;
+
+    // 다른 스레드가 먼저 넣었거나 옛 항목이 남아 있으면 새것으로 바꾼다.
+    if ((old = ent_lookup(e->key, h)))
+        ent_remove(old);
+    e->hnext = table[h];
+    table[h] = e;
+    lru_push(e);
+    // 한도를 넘으면 가장 오래 안 쓴 항목부터 내보낸다.
+    // 사용 중인 항목도 테이블에서는 빠지고 식별자는 마지막 fcache_put에서 닫힌다.
+    if (++nentries > FCACHE_MAX_ENTRIES)
+        ent_remove(lru_tail);
+}
+
+void fcache_init(fcache_build_fn build)
+{
+    build_resp = build;
+    memset(table, 0, sizeof(table));
+    lru_head = lru_tail = NULL;
+    nentries = 0;
+}
+
+// path의 캐시 항목을 참조를 하나 올려서 돌려준다. 다 쓰면 fcache_put으로 돌려줘야 한다.
+// 파일이 없거나 열 수 없으면 NULL을 돌려주고 errno를 남긴다.
+// 일반 파일이 아니면 캐시하지 않고 errno를 EACCES로 둔다.
+fcache_ent *fcache_get(char *path)
+{
+    unsigned h = fcache_hash(path);
+    time_t now = time(NULL);
+    fcache_ent *e;
+    struct stat st;
+    int fd, stale = 0;
+
+    // 최근에 확인한 항목이면 경로를 전혀 찾지 않고 바로 돌려준다.
+    pthread_mutex_lock(&fcache_mutex);
+    if ((e = ent_lookup(path, h)))
+    {
+        if (now - e->checked < FCACHE_REVALIDATE)
+        {
+            e->refcnt++;
+            lru_unlink(e);
+            lru_push(e);
+            pthread_mutex_unlock(&fcache_mutex);
+            return e;
+        }
+        stale = 1;
+    }
+    pthread_mutex_unlock(&fcache_mutex);
+
+    // 확인할 때가 된 항목은 stat만 해 보고 그대로면 계속 쓴다.
+    // stat과 open은 잠금 밖에서 해서 느린 파일 시스템이 다른 요청을 막지 않게 한다.
+    if (stale && stat(path, &st) == 0)
+    {
+        pthread_mutex_lock(&fcache_mutex);
+        if ((e = ent_lookup(path, h)) && same_file(&e->st, &st))
+        {
+            e->checked = now;
+            e->refcnt++;
+            lru_unlink(e);
+            lru_push(e);
+            pthread_mutex_unlock(&fcache_mutex);
+            return e;
+        }
+        pthread_mutex_unlock(&fcache_mutex);
+    }
+
+    // 처음 보거나 바뀐 파일 - 새로 연다.
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC, 0)) < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        int err = (fd >= 0) ? EACCES : errno;
+
+        if (fd >= 0)
+            close(fd);
+        // 지워졌거나 바뀐 파일의 옛 항목은 버린다.
+        pthread_mutex_lock(&fcache_mutex);
+        if ((e = ent_lookup(path, h)))
+            ent_remove(e);
+        pthread_mutex_unlock(&fcache_mutex);
+        errno = err;
+        return NULL;
+    }
+
+    e = ent_new(path, path, fd, &st, FCACHE_IDENTITY, now);
+
+    pthread_mutex_lock(&fcache_mutex);
+    ent_insert(e, h);
+    pthread_mutex_unlock(&fcache_mutex);
+    return e;
+}
+
+// 원본보다 새 .gz 파일인지 - 원본만 고치고 .gz를 다시 만들지 않았으면 쓰지 않는다.
+static int gz_sibling(struct stat *gz, struct stat *orig)
+{
+    return S_ISREG(gz->st_mode) && gz->st_mtime >= orig->st_mtime;
+}
+
+/*
+ * orig 파일의 gzip 변형을 참조를 하나 올려서 돌려준다. 없으면 NULL.
+ * 원본 옆에 원본보다 새 "원본.gz" 파일이 있으면 그 파일을 그대로 쓰고,
+ * 없으면 compress가 참이고 원본이 FCACHE_GZIP_MAX 이하일 때 원본을 한 번 압축해서 메모리에 둔다.
+ * 변형은 원본이 바뀌면 다시 만들고, FCACHE_REVALIDATE초마다 .gz 파일이 생기거나 바뀌었는지 확인한다.
+ * orig는 fcache_get으로 방금 받은(확인한) 항목이어야 한다.
+ */
+fcache_ent *fcache_get_gzip(fcache_ent *orig, int compress)
+{
+    char key[MAXLINE + 8], gzpath[MAXLINE + 8];
+    unsigned h;
+    time_t now = time(NULL);
+    fcache_ent *e;
+    struct stat st;
+    int fd = -1, kind = FCACHE_GZIP_NONE, stale = 0, found;
+
+    if (strlen(orig->path) >= MAXLINE)
+        return NULL;
+    sprintf(key, "%s%s", orig->path, FCACHE_GZIP_SUFFIX);
+    sprintf(gzpath, "%s.gz", orig->path);
+    h = fcache_hash(key);
+
+    // 원본이 그대로이고 최근에 확인한 변형이면 바로 돌려준다.
+    pthread_mutex_lock(&fcache_mutex);
+    if ((e = ent_lookup(key, h)) && same_file(&e->src, &orig->st)) {
+        if (now - e->checked < FCACHE_REVALIDATE)
+            goto hit;
+        stale = 1;
+    }
+    pthread_mutex_unlock(&fcache_mutex);
+
+    // 확인할 때가 됐으면 .gz 파일만 stat 해서 그대로인지(없던 것은 여전히 없는지) 본다.
+    if (stale) {
+        found = stat(gzpath, &st) == 0 && gz_sibling(&st, &orig->st);
+        pthread_mutex_lock(&fcache_mutex);
+        if ((e = ent_lookup(key, h)) && same_file(&e->src, &orig->st) &&
+            (e->gzip == FCACHE_GZIP_FILE ? found && same_file(&e->st, &st) : !found)) {
+            e->checked = now;
+            goto hit;
+        }
+        pthread_mutex_unlock(&fcache_mutex);
+    }
+
+    // 새로 만든다 - 원본보다 새 .gz 파일이 있으면 그것을, 없으면 원본을 압축한다.
+    if ((fd = open(gzpath, O_RDONLY | O_CLOEXEC, 0)) >= 0) {
+        if (fstat(fd, &st) == 0 && gz_sibling(&st, &orig->st))
+            kind = FCACHE_GZIP_FILE;
+        else {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (kind == FCACHE_GZIP_NONE && compress && orig->st.st_size <= FCACHE_GZIP_MAX &&
+        (fd = fcntl(orig->fd, F_DUPFD_CLOEXEC, 0)) >= 0) {
+        kind = FCACHE_GZIP_DEFLATE;
+        st = orig->st;
+    }
+    if (kind == FCACHE_GZIP_NONE)
+        st = orig->st;
+    // 압축에 실패하면 build 함수가 gzip을 FCACHE_GZIP_NONE으로 바꿔 둔다.
+    e = ent_new(key, kind == FCACHE_GZIP_FILE ? gzpath : orig->path, fd, &st, kind, now);
+    e->src = orig->st;
+
+    pthread_mutex_lock(&fcache_mutex);
+    ent_insert(e, h);
+    if (e->gzip == FCACHE_GZIP_NONE) {
+        ent_release(e);
+        e = NULL;
+    }
+    pthread_mutex_unlock(&fcache_mutex);
+    return e;
+
+ hit:
+    // 변형이 없다고 기억해 둔 항목이면 NULL
+    if (e->gzip == FCACHE_GZIP_NONE)
+        e = NULL;
+    else {
+        e->refcnt++;
+        lru_unlink(e);
+        lru_push(e);
+    }
+    pthread_mutex_unlock(&fcache_mutex);
+    return e;
+}
+
+// fcache_get으로 받은 항목을 돌려준다.
+void fcache_put(fcache_ent *e)
+{
+    pthread_mutex_lock(&fcache_mutex);
+    ent_release(e);
+    pthread_mutex_unlock(&fcache_mutex);
+}
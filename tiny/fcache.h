@@ -0,0 +1,59 @@
+/*
+ * fcache.h - 정적 파일의 열린 식별자와 stat 결과 캐시
+ *
+ * 같은 파일을 여러 번 요청받아도 매번 stat, open, close로 경로를 찾지 않도록
+ * 경로별로 열어 둔 식별자와 struct stat을 보관한다.
+ * 항목 수는 FCACHE_MAX_ENTRIES로 제한하고 넘치면 가장 오래 안 쓴 항목부터 내보낸다.
+ * 파일이 바뀌었는지는 FCACHE_REVALIDATE초가 지난 항목만 stat으로 다시 확인한다.
+ * 항목을 만들 때 fcache_init에 넘긴 함수로 미리 직렬화한 응답도 함께 만들어 둔다.
+ * 파일마다 gzip으로 압축한 표현(변형)을 따로 둘 수 있다 - fcache_get_gzip.
+ */
+#ifndef __FCACHE_H__
+#define __FCACHE_H__
+
+#include "csapp.h"
+
+#define FCACHE_MAX_ENTRIES 256   /* 동시에 열어 두는 파일 수 */
+#define FCACHE_BUCKETS 512       /* 해시 테이블 크기 */
+#define FCACHE_REVALIDATE 1      /* 이 시간(초)이 지난 항목은 다시 stat 한다 */
+#define FCACHE_RESP_MAX 65536    /* 이 크기 이하의 파일은 본문까지 응답 버퍼에 담는다 */
+#define FCACHE_GZIP_MAX 262144   /* .gz 파일이 없을 때 직접 압축해 두는 원본의 최대 크기 */
+#define FCACHE_GZIP_SUFFIX " gzip"   /* gzip 변형의 키 - 요청 대상에는 공백이 올 수 없다 */
+
+/* 항목이 담은 표현 */
+#define FCACHE_IDENTITY    0     /* 파일 그대로 */
+#define FCACHE_GZIP_FILE   1     /* 옆에 있는 .gz 파일 */
+#define FCACHE_GZIP_DEFLATE 2    /* 원본을 처음 요청 때 압축해서 메모리에 둔 것 */
+#define FCACHE_GZIP_NONE   3     /* gzip 변형이 없다 - 매번 .gz를 찾지 않도록 기억해 둔다 */
+
+typedef struct fcache_ent {
+    char *key;                   /* 테이블 키 - 파일 그대로면 path와 같다 */
+    char *path;                  /* 연 파일 */
+    int fd;                      /* 읽기 전용으로 열린 식별자 - 오프셋을 지정하는 pread/sendfile로만 읽는다 */
+    struct stat st;
+    int gzip;                    /* FCACHE_IDENTITY, FCACHE_GZIP_* */
+    struct stat src;             /* gzip 변형을 만들 때의 원본 - 원본이 바뀌면 다시 만든다 */
+    off_t size;                  /* 보낼 본문의 길이 - 직접 압축했으면 압축한 길이 */
+    time_t checked;              /* 마지막으로 파일과 맞춰 본 시각 */
+    /* 미리 만든 응답 - 상태 줄과 헤더, 작은 파일이면 본문까지 한 버퍼에 이어 둔다.
+       항목이 테이블에 들어가기 전에 만들고 그 뒤로는 바꾸지 않으므로 잠금 없이 읽는다. */
+    char *resp;
+    size_t head_len;             /* 헤더 부분의 길이 - Connection 헤더와 끝의 빈 줄은 빠져 있다 */
+    size_t resp_len;             /* 본문을 담았으면 head_len + size, 아니면 head_len */
+    /* 조건부/범위 요청에 쓰는 검증자와 MIME 유형 - 응답과 함께 만든다. */
+    char etag[64];
+    char last_modified[32];
+    char filetype[32];
+    int refcnt;                  /* 캐시 자신과 사용 중인 요청의 참조 수 */
+    struct fcache_ent *hnext;    /* 같은 버킷의 다음 항목 */
+    struct fcache_ent *prev, *next;  /* LRU 목록 - 앞쪽이 최근 */
+} fcache_ent;
+
+typedef void (*fcache_build_fn)(fcache_ent *e);
+
+void fcache_init(fcache_build_fn build);
+fcache_ent *fcache_get(char *path);
+fcache_ent *fcache_get_gzip(fcache_ent *orig, int compress);
+void fcache_put(fcache_ent *e);
+
+#endif /* __FCACHE_H__ */
@@ -0,0 +1,32 @@
+/*
+ * adder.c - cgi-bin/adder와 같은 일을 하는 tiny 모듈
+ *
+ * /cgi-bin/adder?1&2 요청을 fork/exec 없이 tiny의 작업 스레드 안에서 처리한다.
+ * 모듈을 빼면(mod/adder.so를 지우면) 같은 요청은 다시 CGI 프로그램이 처리한다.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "tmod.h"
+
+// 쿼리 "1&2"의 두 수를 더한 HTML 페이지를 만든다.
+static int add(tmod_req *req, tmod_resp *resp)
+{
+    char *p;
+    int n1 = 0, n2 = 0;
+
+    // & 앞뒤의 두 숫자 - &가 없으면 둘 다 0이다.
+    if ((p = strchr(req->query, '&')) != NULL) {
+        n1 = atoi(req->query);
+        n2 = atoi(p + 1);
+    }
+    fprintf(resp->out, "Welcome to add.com: ");
+    fprintf(resp->out, "The Internet addition portal.\r\n<p>");
+    fprintf(resp->out, "The answer is: %d + %d = %d\r\n<p>", n1, n2, n1 + n2);
+    fprintf(resp->out, "Thanks for visiting!\r\n");
+    return 0;
+}
+
+int tmod_init(tmod_register_fn reg)
+{
+    return reg("/cgi-bin/adder", add);
+}
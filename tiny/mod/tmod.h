@@ -0,0 +1,50 @@
+/*
+ * tmod.h - tiny 핸들러 모듈 인터페이스
+ *
+ * 모듈은 공유 라이브러리(.so)로 빌드해서 tiny를 실행하는 디렉터리의 mod/에 둔다.
+ * tiny는 시작할 때 mod/의 .so를 모두 dlopen 하고 각 모듈의 tmod_init을 한 번 부른다.
+ * tmod_init은 받은 reg 함수로 URI 접두사마다 핸들러를 등록한다.
+ *
+ *     static int hello(tmod_req *req, tmod_resp *resp)
+ *     {
+ *         fprintf(resp->out, "hello %s\n", req->query);
+ *         return 0;
+ *     }
+ *
+ *     int tmod_init(tmod_register_fn reg)
+ *     {
+ *         return reg("/hello", hello);
+ *     }
+ *
+ * 등록한 접두사와 같거나 접두사 뒤에 '/'나 '?'가 이어지는 요청은 CGI 대신 핸들러가 처리한다.
+ * 핸들러는 tiny의 작업 스레드들에서 동시에 불리므로 전역 상태를 건드리려면 직접 잠가야 한다.
+ */
+#ifndef __TMOD_H__
+#define __TMOD_H__
+
+#include <stdio.h>
+
+typedef struct {
+    char *method;            /* 요청 메소드 */
+    char *uri;               /* 요청 대상 전체 */
+    char *path;              /* '?' 앞 부분 */
+    char *query;             /* '?' 뒤 부분(CGI의 QUERY_STRING), 없으면 "" */
+} tmod_req;
+
+typedef struct {
+    int status;              /* 상태 코드 - 기본 200 */
+    const char *reason;      /* 사유 문구 - 기본 "OK" */
+    char content_type[64];   /* 기본 "text/html" */
+    FILE *out;               /* 응답 본문 - tiny가 길이를 세어서 Content-length를 붙인다 */
+} tmod_resp;
+
+/* 성공하면 0, 실패하면 음수 - 실패하면 tiny가 본문을 버리고 500으로 답한다. */
+typedef int (*tmod_handler)(tmod_req *req, tmod_resp *resp);
+/* 성공하면 0, 핸들러 표가 가득 찼거나 접두사가 잘못됐으면 -1 */
+typedef int (*tmod_register_fn)(const char *prefix, tmod_handler handler);
+
+/* 모듈이 내보내는 초기화 함수 - 0이 아니면 tiny가 모듈을 내린다. */
+#define TMOD_INIT "tmod_init"
+int tmod_init(tmod_register_fn reg);
+
+#endif /* __TMOD_H__ */
@@ -0,0 +1,149 @@
+/*
+ * module.c - 동적 컨텐츠 핸들러 모듈 로더와 디스패치
+ *
+ * 핸들러 표는 작업 스레드를 만들기 전에 module_init에서만 채우고
+ * 그 뒤로는 읽기만 하므로 잠그지 않는다.
+ */
+#include "module.h"
+#include <dirent.h>
+#include <dlfcn.h>
+
+typedef struct {
+    char prefix[MAXLINE];
+    size_t len;
+    tmod_handler fn;
+} module_handler;
+
+static module_handler handlers[MODULE_MAX_HANDLERS];
+static int nhandlers;
+
+// 모듈의 tmod_init이 부르는 등록 함수
+static int module_register(const char *prefix, tmod_handler fn)
+{
+    if (nhandlers == MODULE_MAX_HANDLERS || prefix[0] != '/' || strlen(prefix) >= MAXLINE || !fn)
+        return -1;
+    strcpy(handlers[nhandlers].prefix, prefix);
+    handlers[nhandlers].len = strlen(prefix);
+    handlers[nhandlers].fn = fn;
+    nhandlers++;
+    return 0;
+}
+
+// dir의 .so 파일을 모두 불러 와서 핸들러를 등록하게 한다.
+// 디렉터리가 없으면 모듈 없이 돈다. 불러오지 못한 모듈은 알리고 건너뛴다.
+void module_init(char *dir)
+{
+    char path[MAXLINE];
+    DIR *d;
+    struct dirent *de;
+    size_t len;
+    int before;
+    void *so;
+    int (*init)(tmod_register_fn);
+
+    nhandlers = 0;
+    if (!(d = opendir(dir)))
+        return;
+    while ((de = readdir(d)) != NULL) {
+        len = strlen(de->d_name);
+        if (len < 4 || strcmp(de->d_name + len - 3, ".so"))
+            continue;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >= (int)sizeof(path))
+            continue;
+        // 모듈끼리 심볼이 섞이지 않게 RTLD_LOCAL로 불러 온다.
+        if (!(so = dlopen(path, RTLD_NOW | RTLD_LOCAL))) {
+            fprintf(stderr, "module: %s\n", dlerror());
+            continue;
+        }
+        before = nhandlers;
+        if (!(init = (int (*)(tmod_register_fn))dlsym(so, TMOD_INIT)) || init(module_register) != 0) {
+            // 실패한 모듈이 일부라도 등록했으면 내리기 전에 표에서 지운다.
+            nhandlers = before;
+            fprintf(stderr, "module: %s: %s failed\n", path, TMOD_INIT);
+            dlclose(so);
+            continue;
+        }
+        printf("module: loaded %s\n", path);
+    }
+    closedir(d);
+}
+
+// uri를 맡은 핸들러 - 가장 긴 접두사가 이긴다. 없으면 NULL
+// 접두사 바로 뒤는 URI의 끝이거나 '/', '?'여야 한다("/cgi-bin/adder"는 "/cgi-bin/adder2"를 맡지 않는다).
+static module_handler *module_lookup(char *uri)
+{
+    module_handler *best = NULL;
+    char c;
+    int i;
+
+    for (i = 0; i < nhandlers; i++) {
+        if (strncmp(uri, handlers[i].prefix, handlers[i].len))
+            continue;
+        c = uri[handlers[i].len];
+        if ((c == '\0' || c == '/' || c == '?' || handlers[i].prefix[handlers[i].len - 1] == '/') &&
+            (!best || handlers[i].len > best->len))
+            best = &handlers[i];
+    }
+    return best;
+}
+
+/*
+ * uri를 맡은 모듈이 있으면 작업 스레드 안에서 핸들러를 불러 응답을 보낸다.
+ * 본문은 메모리 스트림에 모아서 길이를 알고 보내므로 keep이면 연결을 계속 쓸 수 있다.
+ * 반환값: 맡은 모듈이 없으면 0, 응답을 보냈으면 1, 클라이언트에게 쓰지 못했으면 -1
+ */
+int module_serve(int fd, char *uri, char *method, int keep)
+{
+    module_handler *h;
+    char path[MAXLINE], head[MAXBUF], *q, *body = NULL;
+    size_t body_len = 0;
+    tmod_req req;
+    tmod_resp resp;
+    struct iovec iov[2];
+    int n;
+
+    if (!(h = module_lookup(uri)))
+        return 0;
+
+    // 핸들러에게는 요청 대상을 경로와 쿼리로 나눠서 넘긴다.
+    strncpy(path, uri, sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+    if ((q = strchr(path, '?')) != NULL)
+        *q++ = '\0';
+    req.method = method;
+    req.uri = uri;
+    req.path = path;
+    req.query = q ? q : "";
+    resp.status = 200;
+    resp.reason = "OK";
+    strcpy(resp.content_type, "text/html");
+    if (!(resp.out = open_memstream(&body, &body_len)))
+        return -1;
+
+    if (h->fn(&req, &resp) < 0) {
+        resp.status = 500;
+        resp.reason = "Internal Server Error";
+        strcpy(resp.content_type, "text/plain");
+        fclose(resp.out);
+        body_len = 0;
+    }
+    else
+        fclose(resp.out);
+    resp.content_type[sizeof(resp.content_type) - 1] = '\0';
+
+    n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\n"
+                 "Server: Tiny Web Server\r\n"
+                 "Content-length: %lu\r\n"
+                 "Content-type: %s\r\n"
+                 "Connection: %s\r\n\r\n",
+                 resp.status, resp.reason ? resp.reason : "", (unsigned long)body_len,
+                 resp.content_type, keep ? "keep-alive" : "close");
+    printf("Response headers: \n%s", head);
+    iov[0].iov_base = head;
+    iov[0].iov_len = n < (int)sizeof(head) ? n : (int)sizeof(head) - 1;
+    iov[1].iov_base = body;
+    iov[1].iov_len = body_len;
+    n = rio_writev(fd, iov, strcasecmp(method, "HEAD") ? 2 : 1) < 0 ? -1 : 1;
+    free(body);
+    return n;
+}
@@ -0,0 +1,21 @@
+/*
+ * module.h - 프로세스 안에서 도는 동적 컨텐츠 핸들러 모듈
+ *
+ * mod/ 디렉터리의 공유 라이브러리를 시작할 때 불러 와서 모듈이 등록한 URI 접두사의
+ * 요청은 작업 스레드 안에서 바로 처리한다. 요청마다 fork/exec 하는 CGI보다 훨씬 싸다.
+ * 모듈 쪽 인터페이스는 mod/tmod.h에 있다.
+ * 어느 모듈도 맡지 않은 요청은 예전처럼 CGI나 정적 파일로 처리한다.
+ */
+#ifndef __MODULE_H__
+#define __MODULE_H__
+
+#include "csapp.h"
+#include "mod/tmod.h"
+
+#define MODULE_DIR "./mod"       /* 모듈을 찾는 디렉터리 */
+#define MODULE_MAX_HANDLERS 32   /* 등록할 수 있는 핸들러 수 */
+
+void module_init(char *dir);
+int module_serve(int fd, char *uri, char *method, int keep);
+
+#endif /* __MODULE_H__ */
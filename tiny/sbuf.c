@@ -0,0 +1,44 @@
+/*
+ * sbuf.c - 스레드 풀이 공유하는 연결 식별자 유한 버퍼
+ */
+#include "sbuf.h"
+
+// n칸짜리 빈 버퍼를 만든다.
+void sbuf_init(sbuf_t *sp, int n)
+{
+    sp->buf = Calloc(n, sizeof(int));
+    sp->n = n;
+    sp->front = sp->rear = 0;
+    Sem_init(&sp->mutex, 0, 1);
+    Sem_init(&sp->slots, 0, n);
+    Sem_init(&sp->items, 0, 0);
+}
+
+// 버퍼를 해제한다.
+void sbuf_deinit(sbuf_t *sp)
+{
+    Free(sp->buf);
+}
+
+// 빈 칸이 생길 때까지 기다렸다가 item을 뒤에 넣는다.
+void sbuf_insert(sbuf_t *sp, int item)
+{
+    P(&sp->slots);
+    P(&sp->mutex);
+    sp->buf[(++sp->rear) % (sp->n)] = item;
+    V(&sp->mutex);
+    V(&sp->items);
+}
+
+// 항목이 생길 때까지 기다렸다가 앞의 항목을 꺼내 돌려준다.
+int sbuf_remove(sbuf_t *sp)
+{
+    int item;
+
+    P(&sp->items);
+    P(&sp->mutex);
+    item = sp->buf[(++sp->front) % (sp->n)];
+    V(&sp->mutex);
+    V(&sp->slots);
+    return item;
+}
@@ -0,0 +1,27 @@
+/*
+ * sbuf.h - 스레드 풀이 공유하는 연결 식별자 유한 버퍼
+ *
+ * 메인 스레드가 accept한 connfd를 넣고(생산자), 작업 스레드들이 꺼내 간다(소비자).
+ * 세마포어로 빈 칸과 찬 칸을 세므로 버퍼가 가득 차면 생산자가, 비면 소비자가 기다린다.
+ */
+#ifndef __SBUF_H__
+#define __SBUF_H__
+
+#include "csapp.h"
+
+typedef struct {
+    int *buf;          /* 원형 버퍼 */
+    int n;             /* 최대 칸 수 */
+    int front;         /* buf[(front+1)%n]이 첫 항목 */
+    int rear;          /* buf[rear%n]이 마지막 항목 */
+    sem_t mutex;       /* buf 접근 보호 */
+    sem_t slots;       /* 빈 칸 수 */
+    sem_t items;       /* 찬 칸 수 */
+} sbuf_t;
+
+void sbuf_init(sbuf_t *sp, int n);
+void sbuf_deinit(sbuf_t *sp);
+void sbuf_insert(sbuf_t *sp, int item);
+int sbuf_remove(sbuf_t *sp);
+
+#endif /* __SBUF_H__ */